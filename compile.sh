@@ -5,18 +5,18 @@ set -o errexit -o nounset -o pipefail -o xtrace
 : ${PREFIX:="."}
 
 declare -a SRC
-SRC=(htable rng utils rows store acc rotate query)
+SRC=(htable rng utils rows pool set cache store manifest acc rotate query)
 
 declare -a BIN
 BIN=(load dump query rotate ingest merge count)
 
 declare -a TEST
-TEST=(index coder store)
+TEST=(index coder store mph query)
 
 CC=${OTHERC:-gcc}
 LEAKCHECK_ENABLED=${LEAKCHECK_ENABLED:-}
 
-CFLAGS="-ggdb -O3 -march=native -pipe -std=gnu11 -D_GNU_SOURCE"
+CFLAGS="-ggdb -O3 -march=native -pipe -std=gnu11 -D_GNU_SOURCE -pthread"
 CFLAGS="$CFLAGS -I${PREFIX}/src"
 
 CFLAGS="$CFLAGS -Werror -Wall -Wextra"
@@ -32,6 +32,8 @@ CFLAGS="$CFLAGS -Wno-strict-aliasing"
 CFLAGS="$CFLAGS -fno-strict-aliasing"
 CFLAGS="$CFLAGS -Wno-implicit-fallthrough"
 
+LIBS="-lm"
+
 OBJ=""
 for src in "${SRC[@]}"; do
     $CC -c -o "$src.o" "${PREFIX}/src/$src.c" $CFLAGS
@@ -40,16 +42,16 @@ done
 ar rcs librill.a $OBJ
 
 for bin in "${BIN[@]}"; do
-    $CC -o "rill_$bin" "${PREFIX}/src/rill_$bin.c" librill.a $CFLAGS
+    $CC -o "rill_$bin" "${PREFIX}/src/rill_$bin.c" librill.a $CFLAGS $LIBS
 done
 
 for test in "${TEST[@]}"; do
-    $CC -o "test_$test" "${PREFIX}/test/${test}_test.c" librill.a $CFLAGS
+    $CC -o "test_$test" "${PREFIX}/test/${test}_test.c" librill.a $CFLAGS $LIBS
     "./test_$test"
 done
 
 # this one takes a while so it's usually run manually
-$CC -o "test_rotate" "${PREFIX}/test/rotate_test.c" librill.a $CFLAGS
+$CC -o "test_rotate" "${PREFIX}/test/rotate_test.c" librill.a $CFLAGS $LIBS
 
 
 if [ -n "$LEAKCHECK_ENABLED" ]; then
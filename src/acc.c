@@ -5,6 +5,7 @@
 
 #include "rill.h"
 #include "utils.h"
+#include "manifest.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -192,6 +193,22 @@ void rill_acc_ingest(struct rill_acc *acc, rill_val_t a, rill_val_t b)
     atomic_store_explicit(&acc->head->write, write + 1, memory_order_release);
 }
 
+// The store is written to its pending file and only takes its name once the
+// manifest lists it so a failure can't leave an unlisted copy of the rows
+// behind to be written again by the next call.
+static bool acc_manifest(const char *file)
+{
+    char dir[PATH_MAX];
+    strncpy(dir, file, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+
+    char *sep = strrchr(dir, '/');
+    if (sep) *sep = '\0';
+    else strcpy(dir, ".");
+
+    return manifest_update(dir, file, NULL, 0);
+}
+
 bool rill_acc_write(struct rill_acc *acc, const char *file, rill_ts_t now)
 {
     size_t start = atomic_load_explicit(&acc->head->read, memory_order_acquire);
@@ -215,16 +232,22 @@ bool rill_acc_write(struct rill_acc *acc, const char *file, rill_ts_t now)
         if (!rill_rows_push(&rows, row->a, row->b)) goto fail_rows_push;
     }
 
-    if (!rill_store_write(file, now, 0, &rows)) {
+    char pending[PATH_MAX];
+    manifest_pending(file, pending, sizeof(pending));
+
+    if (!rill_store_write(pending, now, 0, &rows)) {
         rill_fail("unable to write acc file '%s'", file);
         goto fail_write;
     }
 
+    if (!acc_manifest(file)) goto fail_manifest;
+
     atomic_store_explicit(&acc->head->read, end, memory_order_release);
 
     rill_rows_free(&rows);
     return true;
 
+  fail_manifest:
   fail_write:
   fail_rows_push:
     rill_rows_free(&rows);
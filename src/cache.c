@@ -0,0 +1,293 @@
+/* cache.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "cache.h"
+#include "htable.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct cache_entry
+{
+    rill_val_t key; // 0 for free slots.
+    enum rill_col col;
+    bool referenced;
+    size_t seq; // order of insertion.
+
+    size_t len; // next free slot + 1 for free slots.
+    struct rill_row *rows;
+};
+
+struct cache
+{
+    pthread_mutex_t lock;
+
+    size_t gen;
+    size_t seq;
+    size_t budget;
+    size_t bytes;
+    size_t hits, misses;
+
+    // Maps keys to their slot + 1.
+    struct htable index[rill_cols];
+
+    size_t hand;
+    size_t free; // first free slot + 1.
+    size_t len, cap;
+    struct cache_entry *slots;
+};
+
+static size_t cache_entry_bytes(size_t rows)
+{
+    return sizeof(struct cache_entry) + rows * sizeof(struct rill_row);
+}
+
+struct cache *cache_open(size_t bytes, size_t gen)
+{
+    struct cache *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        rill_fail("unable to allocate cache: %lu", bytes);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->gen = gen;
+    cache->budget = bytes;
+    return cache;
+}
+
+void cache_close(struct cache *cache)
+{
+    for (size_t i = 0; i < cache->len; ++i) {
+        if (cache->slots[i].key) free(cache->slots[i].rows);
+    }
+    for (size_t col = 0; col < rill_cols; ++col) htable_reset(&cache->index[col]);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->slots);
+    free(cache);
+}
+
+
+// -----------------------------------------------------------------------------
+// evict
+// -----------------------------------------------------------------------------
+
+static void cache_drop(struct cache *cache, size_t slot)
+{
+    struct cache_entry *entry = &cache->slots[slot];
+
+    htable_del(&cache->index[entry->col], entry->key);
+    cache->bytes -= cache_entry_bytes(entry->len);
+
+    free(entry->rows);
+    *entry = (struct cache_entry) { .len = cache->free };
+    cache->free = slot + 1;
+}
+
+// Sweeps the clock until an unreferenced entry is found and evicted. Entries
+// that were hit since the last sweep get a second chance.
+static void cache_evict(struct cache *cache)
+{
+    while (true) {
+        size_t slot = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->len;
+
+        struct cache_entry *entry = &cache->slots[slot];
+        if (!entry->key) continue;
+
+        if (entry->referenced) entry->referenced = false;
+        else {
+            cache_drop(cache, slot);
+            return;
+        }
+    }
+}
+
+static bool cache_slot(struct cache *cache, size_t *slot)
+{
+    if (cache->free) {
+        *slot = cache->free - 1;
+        cache->free = cache->slots[*slot].len;
+        return true;
+    }
+
+    if (cache->len == cache->cap) {
+        size_t cap = cache->cap ? cache->cap * 2 : 64;
+        struct cache_entry *slots = realloc(cache->slots, cap * sizeof(*slots));
+        if (!slots) return false;
+
+        cache->slots = slots;
+        cache->cap = cap;
+    }
+
+    *slot = cache->len++;
+    cache->slots[*slot] = (struct cache_entry) {0};
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// ops
+// -----------------------------------------------------------------------------
+
+bool cache_get(
+        struct cache *cache, enum rill_col col, rill_val_t key, struct rill_rows *out)
+{
+    bool hit = false;
+    pthread_mutex_lock(&cache->lock);
+
+    struct htable_ret ret = htable_get(&cache->index[col], key);
+    if (ret.ok) {
+        struct cache_entry *entry = &cache->slots[ret.value - 1];
+
+        if (rill_rows_reserve(out, out->len + entry->len)) {
+            memcpy(out->data + out->len, entry->rows, entry->len * sizeof(entry->rows[0]));
+            out->len += entry->len;
+
+            entry->referenced = true;
+            hit = true;
+        }
+    }
+
+    if (hit) cache->hits++;
+    else cache->misses++;
+
+    pthread_mutex_unlock(&cache->lock);
+    return hit;
+}
+
+void cache_put(
+        struct cache *cache,
+        size_t gen,
+        enum rill_col col,
+        rill_val_t key,
+        const struct rill_rows *rows)
+{
+    size_t bytes = cache_entry_bytes(rows->len);
+    if (bytes > cache->budget) return;
+
+    struct rill_row *copy = NULL;
+    if (rows->len) {
+        if (!(copy = malloc(rows->len * sizeof(*copy)))) return;
+        memcpy(copy, rows->data, rows->len * sizeof(*copy));
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    // The rows might have been computed from stores that were since replaced.
+    if (gen != cache->gen) goto fail;
+
+    // Another thread might have beaten us to it while the query was running.
+    if (htable_get(&cache->index[col], key).ok) goto fail;
+
+    while (cache->bytes + bytes > cache->budget) cache_evict(cache);
+
+    size_t slot = 0;
+    if (!cache_slot(cache, &slot)) goto fail;
+
+    cache->slots[slot] = (struct cache_entry) {
+        .key = key,
+        .col = col,
+        .seq = ++cache->seq,
+        .len = rows->len,
+        .rows = copy,
+    };
+    cache->bytes += bytes;
+    htable_put(&cache->index[col], key, slot + 1);
+
+    pthread_mutex_unlock(&cache->lock);
+    return;
+
+  fail:
+    pthread_mutex_unlock(&cache->lock);
+    free(copy);
+}
+
+struct cache_key
+{
+    enum rill_col col;
+    rill_val_t key;
+};
+
+// Keys that can't be checked are assumed to be stale.
+static bool cache_stale(
+        const struct cache_key *entry, struct rill_store *const *stores, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        size_t count = 0;
+        if (!rill_store_count(stores[i], entry->col, entry->key, &count)) return true;
+        if (count) return true;
+    }
+    return false;
+}
+
+// The stores are checked against a copy of the keys taken outside of the lock
+// so that readers aren't stalled while it happens. Entries added in the
+// meantime weren't checked and are dropped along with the stale ones. Readers
+// can still hit stale entries until then but the stores are only swapped in
+// once we return.
+void cache_invalidate(
+        struct cache *cache, size_t gen, struct rill_store *const *stores, size_t len)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    size_t mark = cache->seq;
+    size_t keys_len = cache->index[rill_col_a].len + cache->index[rill_col_b].len;
+    struct cache_key *keys = calloc(keys_len + 1, sizeof(*keys));
+
+    if (keys) {
+        size_t j = 0;
+        for (size_t i = 0; i < cache->len; ++i) {
+            struct cache_entry *entry = &cache->slots[i];
+            if (entry->key) keys[j++] = (struct cache_key) { entry->col, entry->key };
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    size_t stale = 0;
+    for (size_t i = 0; keys && i < keys_len; ++i) {
+        if (cache_stale(&keys[i], stores, len)) keys[stale++] = keys[i];
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->gen = gen;
+
+    for (size_t i = 0; i < cache->len; ++i) {
+        struct cache_entry *entry = &cache->slots[i];
+        if (entry->key && (!keys || entry->seq > mark)) cache_drop(cache, i);
+    }
+
+    for (size_t i = 0; i < stale; ++i) {
+        struct htable_ret ret = htable_get(&cache->index[keys[i].col], keys[i].key);
+        if (ret.ok) cache_drop(cache, ret.value - 1);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    free(keys);
+}
+
+void cache_stats(struct cache *cache, struct rill_query_cache_stats *out)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    *out = (struct rill_query_cache_stats) {
+        .hits = cache->hits,
+        .misses = cache->misses,
+        .entries = cache->index[rill_col_a].len + cache->index[rill_col_b].len,
+        .bytes = cache->bytes,
+    };
+
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,38 @@
+/* cache.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+#include "rill.h"
+
+
+// -----------------------------------------------------------------------------
+// cache
+// -----------------------------------------------------------------------------
+
+// Bounded cache of the rows of (col, key) pairs. Entries are evicted using the
+// CLOCK algorithm once the memory budget is exceeded. All operations are
+// thread-safe.
+
+struct cache;
+
+struct cache *cache_open(size_t bytes, size_t gen);
+void cache_close(struct cache *);
+
+// Appends the cached rows to out and returns true on a hit.
+bool cache_get(struct cache *, enum rill_col, rill_val_t key, struct rill_rows *out);
+
+// Failures are silently ignored as it's only a cache. Rows computed before the
+// last invalidation, as indicated by gen, are also ignored.
+void cache_put(
+        struct cache *, size_t gen,
+        enum rill_col, rill_val_t key, const struct rill_rows *rows);
+
+// Drops every entry whose key is present in any of the stores and moves the
+// cache to generation gen. Must be serialized with other invalidations.
+void cache_invalidate(
+        struct cache *, size_t gen, struct rill_store *const *stores, size_t len);
+
+void cache_stats(struct cache *, struct rill_query_cache_stats *out);
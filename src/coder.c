@@ -206,6 +206,102 @@ static bool coder_decode(struct decoder *coder, struct rill_row *row)
     return coder_read_val(coder, &row->b);
 }
 
+// Decodes up to cap rows in a single call which keeps the per row cost down to
+// the LEB128 decode and the lookup. Stops early at the end of the column or
+// when reaching a key that isn't below end (0 for no bound) in which case the
+// decoder is left past that key.
+static bool coder_decode_batch(
+        struct decoder *coder, rill_val_t end,
+        struct rill_row *rows, size_t cap, size_t *len)
+{
+    size_t i = 0;
+    rill_val_t key = coder->key;
+
+    while (i < cap) {
+        if (rill_unlikely(!key)) {
+            key = index_get(coder->index, coder->keys);
+            coder->keys++;
+            if (!key || (end && key >= end)) break;
+        }
+
+        rill_val_t val = 0;
+        if (!coder_read_val(coder, &val)) return false;
+
+        if (rill_unlikely(!val)) { key = 0; continue; }
+        rows[i++] = (struct rill_row) { .a = key, .b = val };
+    }
+
+    coder->key = key;
+    *len = i;
+    return true;
+}
+
+// Decodes the ordinals of the current key's list without going through the
+// lookup. Ordinals are sorted in the same order as their values.
+static bool coder_decode_ords(struct decoder *coder, uint64_t *out, size_t cap, size_t *len)
+{
+    uint64_t ord = 0;
+
+    for (*len = 0; *len < cap; (*len)++) {
+        if (!leb128_decode(&coder->it, coder->end, &ord)) {
+            rill_fail("unable to decode value at '%p-%p'\n",
+                    (void *) coder->it, (void *) coder->end);
+            return false;
+        }
+
+        if (!ord) break;
+        out[*len] = ord;
+    }
+
+    return true;
+}
+
+// Scans the list of the current key for an ordinal without going through the
+// lookup. Ordinals within a list are sorted so the scan can stop as soon as it
+// goes past the ordinal.
+static bool coder_contains(struct decoder *coder, uint64_t ord)
+{
+    uint64_t val = 0;
+
+    while (coder->it < coder->end) {
+        if (!leb128_decode(&coder->it, coder->end, &val)) return false;
+        if (!val || val > ord) return false;
+        if (val == ord) return true;
+    }
+
+    return false;
+}
+
+// Counts the values of a list without decoding them. Every LEB128 value ends on
+// the only byte without its continuation bit and the list itself ends on a 0
+// byte which can't show up anywhere else so a word at a time scan will do.
+static size_t coder_count(const uint8_t *it, const uint8_t *end)
+{
+    static const uint64_t high = 0x8080808080808080UL;
+    static const uint64_t low = 0x0101010101010101UL;
+
+    size_t count = 0;
+
+    while (it + sizeof(uint64_t) <= end) {
+        uint64_t word = 0;
+        memcpy(&word, it, sizeof(word));
+
+        // Only the lowest bit is exact which is all we need to find the
+        // terminator.
+        uint64_t zero = (word - low) & ~word & high;
+        if (zero) {
+            uint64_t mask = (1UL << __builtin_ctzl(zero)) - 1;
+            return count + __builtin_popcountl(~word & high & mask);
+        }
+
+        count += __builtin_popcountl(~word & high);
+        it += sizeof(uint64_t);
+    }
+
+    for (; it < end && *it; ++it) count += !(*it & 0x80);
+    return count;
+}
+
 static struct decoder make_decoder_at(
         uint8_t *it, uint8_t *end,
         struct index *lookup,
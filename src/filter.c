@@ -0,0 +1,90 @@
+/* filter.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// -----------------------------------------------------------------------------
+// filter
+// -----------------------------------------------------------------------------
+
+// Split block bloom filter over the keys of a column. Every key sets one bit in
+// each of the 8 words of a single 32 bytes block which means that a lookup
+// costs at most one cache miss. Used to skip stores that don't contain a key
+// without having to go through the index.
+//
+// At 10 bits per key the false positive rate sits around 1%.
+
+enum
+{
+    filter_block_words = 8,
+    filter_bits_per_key = 10,
+};
+
+static const uint32_t filter_salts[filter_block_words] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+struct rill_packed filter_block
+{
+    uint32_t words[filter_block_words];
+};
+
+struct rill_packed filter
+{
+    uint64_t len;
+    uint64_t __unused;
+    struct filter_block blocks[];
+};
+
+static const uint64_t filter_seed = 0x46494C54;
+
+static size_t filter_blocks(size_t keys)
+{
+    return (keys * filter_bits_per_key) / (sizeof(struct filter_block) * 8) + 1;
+}
+
+static size_t filter_cap(size_t keys)
+{
+    return sizeof(struct filter) + filter_blocks(keys) * sizeof(struct filter_block);
+}
+
+static inline struct filter_block *filter_block(struct filter *filter, uint64_t hash)
+{
+    return &filter->blocks[mph_range(hash, filter->len)];
+}
+
+static inline uint32_t filter_mask(uint32_t hash, size_t word)
+{
+    return 1U << ((hash * filter_salts[word]) >> 27);
+}
+
+static void filter_put(struct filter *filter, rill_val_t key)
+{
+    uint64_t hash = mph_hash(key, filter_seed);
+    struct filter_block *block = filter_block(filter, hash);
+
+    for (size_t i = 0; i < filter_block_words; ++i)
+        block->words[i] |= filter_mask(hash, i);
+}
+
+static bool filter_test(struct filter *filter, rill_val_t key)
+{
+    uint64_t hash = mph_hash(key, filter_seed);
+    struct filter_block *block = filter_block(filter, hash);
+
+    uint32_t miss = 0;
+    for (size_t i = 0; i < filter_block_words; ++i)
+        miss |= ~block->words[i] & filter_mask(hash, i);
+
+    return !miss;
+}
+
+static void filter_build(struct filter *filter, const rill_val_t *keys, size_t len)
+{
+    filter->len = filter_blocks(len);
+    memset(filter->blocks, 0, filter->len * sizeof(filter->blocks[0]));
+
+    for (size_t i = 0; i < len; ++i)
+        filter_put(filter, keys[i]);
+}
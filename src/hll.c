@@ -0,0 +1,101 @@
+/* hll.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// -----------------------------------------------------------------------------
+// hll
+// -----------------------------------------------------------------------------
+
+// HyperLogLog sketches of the values of the heaviest keys in a column. Keys with
+// fewer values then hll_min_degree aren't sketched as it's cheaper to just
+// hash their list when needed. Values are hashed (as opposed to their ordinals)
+// which means that sketches from different stores can be unioned.
+//
+// The section is a sorted list of the index positions of the sketched keys
+// followed by their registers.
+
+enum
+{
+    hll_bits = 10,
+    hll_regs = 1 << hll_bits,
+    hll_min_degree = 1 << 12,
+};
+
+static const uint64_t hll_seed = 0x484C4C;
+
+struct rill_packed hll
+{
+    uint64_t len;
+    uint64_t __unused;
+
+    // followed by the registers of each key: uint8_t[len][hll_regs]
+    uint64_t keys[];
+};
+
+// Worst case is every key sitting right on the threshold.
+static size_t hll_cap(size_t rows)
+{
+    size_t len = rows / hll_min_degree;
+    return sizeof(struct hll) + len * (sizeof(uint64_t) + hll_regs);
+}
+
+static size_t hll_len(struct hll *hll)
+{
+    return sizeof(*hll) + hll->len * (sizeof(uint64_t) + hll_regs);
+}
+
+static inline uint8_t *hll_regs_at(struct hll *hll, size_t i)
+{
+    return (uint8_t *) (hll->keys + hll->len) + i * hll_regs;
+}
+
+static inline void hll_add(uint8_t *regs, rill_val_t val)
+{
+    uint64_t hash = mph_hash(val, hll_seed);
+
+    size_t reg = hash >> (64 - hll_bits);
+    uint8_t rank = __builtin_clzl((hash << hll_bits) | (1UL << (hll_bits - 1))) + 1;
+
+    if (rank > regs[reg]) regs[reg] = rank;
+}
+
+static void hll_union(uint8_t *regs, const uint8_t *other)
+{
+    for (size_t i = 0; i < hll_regs; ++i)
+        if (other[i] > regs[i]) regs[i] = other[i];
+}
+
+static double hll_estimate(const uint8_t *regs)
+{
+    double sum = 0;
+    size_t zeros = 0;
+
+    for (size_t i = 0; i < hll_regs; ++i) {
+        sum += 1.0 / (1UL << regs[i]);
+        zeros += !regs[i];
+    }
+
+    const double m = hll_regs;
+    const double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+
+    // Small range correction via linear counting.
+    if (estimate <= 2.5 * m && zeros)
+        estimate = m * log(m / zeros);
+
+    return estimate;
+}
+
+static uint8_t *hll_find(struct hll *hll, size_t key_idx)
+{
+    size_t low = 0, high = hll->len;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (hll->keys[mid] < key_idx) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low == hll->len || hll->keys[low] != key_idx) return NULL;
+    return hll_regs_at(hll, low);
+}
@@ -140,3 +140,26 @@ struct htable_ret htable_put(struct htable *ht, uint64_t key, uint64_t value)
     htable_resize(ht, ht->cap * 2);
     return htable_put(ht, key, value);
 }
+
+// Lookups scan the whole probe window so the bucket can just be cleared. This
+// can leave a hole in front of another key of the window which htable_put
+// won't see past so callers that delete must check for the key before adding.
+struct htable_ret htable_del(struct htable *ht, uint64_t key)
+{
+    assert(key);
+    if (!ht->cap) return (struct htable_ret) { .ok = false };
+
+    uint64_t hash = hash_key(key);
+
+    for (size_t i = 0; i < probe_window; ++i) {
+        struct htable_bucket *bucket = &ht->table[(hash + i) % ht->cap];
+        if (bucket->key != key) continue;
+
+        struct htable_ret ret = { .ok = true, .value = bucket->value };
+        *bucket = (struct htable_bucket) {0};
+        ht->len--;
+        return ret;
+    }
+
+    return (struct htable_ret) { .ok = false };
+}
@@ -53,6 +53,31 @@ static bool index_find(
     return true;
 }
 
+// Galloping search for the first entry whose key is not smaller then the given
+// key, starting from a known lower bound. Meant for walking the index with a
+// sorted batch of keys where the next key is usually close to the previous one.
+static size_t index_lower_bound(struct index *index, rill_val_t key, size_t start)
+{
+    struct index_kv *data = index->data;
+    if (start >= index->len || data[start].key >= key) return start;
+
+    size_t low = start;
+    size_t step = 1;
+    while (low + step < index->len && data[low + step].key < key) {
+        low += step;
+        step *= 2;
+    }
+
+    size_t high = low + step < index->len ? low + step : index->len;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (data[mid].key < key) low = mid;
+        else high = mid;
+    }
+
+    return high;
+}
+
 static rill_val_t index_get(struct index *index, size_t i)
 {
     return i < index->len ? index->data[i].key : 0;
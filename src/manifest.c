@@ -0,0 +1,777 @@
+/* manifest.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "manifest.h"
+#include "pool.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// scan_dir
+// -----------------------------------------------------------------------------
+
+// Suffixes of the stores that are in the process of being published or removed
+// by manifest_update. They're never read.
+static const char pending_ext[] = ".tmp";
+static const char removed_ext[] = ".rm";
+
+static bool has_ext(const char *name, const char *ext)
+{
+    size_t len = strnlen(name, NAME_MAX);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && !strcmp(name + len - ext_len, ext);
+}
+
+static bool is_rill_file(const char *name)
+{
+    static const char ext[] = ".rill";
+
+    size_t len = strnlen(name, NAME_MAX);
+    if (len < sizeof(ext)) return false;
+    if (has_ext(name, pending_ext) || has_ext(name, removed_ext)) return false;
+
+    return strstr(name, ext);
+}
+
+static struct rill_store *scan_dir_find(
+        const char *file, struct rill_store *const *open, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        if (!strcmp(rill_store_file(open[i]), file)) return open[i];
+    }
+    return NULL;
+}
+
+// Stores are opened in two passes: their names are first gathered from the
+// manifest or the directory and then opened, possibly in parallel, which
+// overlaps the stat, open and first page fault of every store on cold starts.
+struct scan_dir
+{
+    const char *dir;
+    unsigned flags;
+
+    size_t len, cap;
+    char (*names)[NAME_MAX + 1];
+    struct rill_store **list;
+    bool missing; // a store was removed between listing and opening it.
+
+    struct rill_open_stats *stats; // one per worker
+};
+
+static void scan_dir_free(struct scan_dir *scan)
+{
+    free(scan->names);
+    free(scan->list);
+    free(scan->stats);
+}
+
+static bool scan_dir_push(struct scan_dir *scan, const char *name)
+{
+    if (scan->len == scan->cap) {
+        size_t cap = scan->cap ? scan->cap * 2 : 64;
+        char (*names)[NAME_MAX + 1] = realloc(scan->names, cap * sizeof(*names));
+        if (!names) {
+            rill_fail("unable to allocate store list for '%s': %lu", scan->dir, cap);
+            return false;
+        }
+
+        scan->names = names;
+        scan->cap = cap;
+    }
+
+    snprintf(scan->names[scan->len], sizeof(scan->names[0]), "%s", name);
+    scan->len++;
+    return true;
+}
+
+static bool scan_dir_readdir(struct scan_dir *scan)
+{
+    DIR *dir_handle = opendir(scan->dir);
+    if (!dir_handle) {
+        if (errno == ENOENT) return true;
+        rill_fail_errno("unable to open dir '%s'", scan->dir);
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent *entry = NULL;
+    while (ok && (entry = readdir(dir_handle))) {
+        // I found the one filesystem that doesn't support dirent->d_type...
+        if (!is_rill_file(entry->d_name)) continue;
+        ok = scan_dir_push(scan, entry->d_name);
+    }
+
+    closedir(dir_handle);
+    return ok;
+}
+
+static bool scan_dir_task(void *ctx, size_t worker, size_t task)
+{
+    struct scan_dir *scan = ctx;
+    if (scan->list[task]) return true;
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%s", scan->dir, scan->names[task]);
+
+    // Stores that can't be opened are skipped as is tradition.
+    scan->list[task] = rill_store_open_stats(file, scan->flags, &scan->stats[worker]);
+    if (!scan->list[task] && rill_errno.errno_ == ENOENT)
+        __atomic_store_n(&scan->missing, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+static bool scan_dir_open(
+        struct scan_dir *scan, struct pool *pool,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len)
+{
+    size_t threads = pool ? pool_threads(pool) : 1;
+    scan->stats = calloc(threads, sizeof(scan->stats[0]));
+    scan->list = calloc(scan->len ? scan->len : 1, sizeof(scan->list[0]));
+    if (!scan->stats || !scan->list) {
+        rill_fail("unable to allocate store list for '%s': %lu", scan->dir, scan->len);
+        return false;
+    }
+
+    size_t pending = 0;
+    for (size_t i = 0; i < scan->len; ++i) {
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%s", scan->dir, scan->names[i]);
+
+        struct rill_store *store = scan_dir_find(file, open, open_len);
+        if (store) scan->list[i] = rill_store_ref(store);
+        else pending++;
+    }
+
+    if (pool && pending > 1) pool_run(pool, scan->len, scan_dir_task, scan);
+    else {
+        for (size_t i = 0; i < scan->len; ++i) scan_dir_task(scan, 0, i);
+    }
+
+    *len = 0;
+    for (size_t i = 0; i < scan->len; ++i) {
+        if (scan->list[i]) scan->list[(*len)++] = scan->list[i];
+    }
+
+    *list = scan->list;
+    scan->list = NULL;
+    return true;
+}
+
+static void scan_dir_stats(
+        const struct scan_dir *scan, size_t threads, struct rill_open_stats *out)
+{
+    for (size_t i = 0; i < threads; ++i) {
+        const struct rill_open_stats *stats = &scan->stats[i];
+        out->stores += stats->stores;
+        out->stat_ns += stats->stat_ns;
+        out->open_ns += stats->open_ns;
+        out->map_ns += stats->map_ns;
+        out->check_ns += stats->check_ns;
+    }
+}
+
+static bool manifest_open_once(
+        const char *dir, unsigned flags, struct pool *pool,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len,
+        struct rill_open_stats *stats, bool *missing)
+{
+    uint64_t t0 = nsecs_now();
+    struct scan_dir scan = { .dir = dir, .flags = flags };
+
+    bool found = false;
+    struct manifest manifest = {0};
+    if (!manifest_load(dir, &manifest, &found)) return false;
+
+    bool ok = true;
+    if (!found) ok = scan_dir_readdir(&scan);
+    else {
+        for (size_t i = 0; ok && i < manifest.len; ++i)
+            ok = scan_dir_push(&scan, manifest.list[i].name);
+    }
+    manifest_free(&manifest);
+
+    stats->list_ns += nsecs_now() - t0;
+
+    if (ok) ok = scan_dir_open(&scan, pool, list, len, open, open_len);
+    if (scan.stats) scan_dir_stats(&scan, pool ? pool_threads(pool) : 1, stats);
+    *missing = scan.missing;
+
+    scan_dir_free(&scan);
+    return ok;
+}
+
+static int manifest_lock_shared(const char *dir);
+static void manifest_unlock(int fd);
+
+// Updates rename the stores they remove before saving the manifest and only
+// rename the stores they publish after, so a listing that races with an update
+// can name stores that are missing. Such listings are redone while holding the
+// lock in shared mode which waits for the update to complete. Directories
+// without a lock file have never been updated and are read as is.
+bool manifest_open_dir(
+        const char *dir, unsigned flags, struct pool *pool,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len,
+        struct rill_open_stats *stats)
+{
+    *list = NULL;
+    *len = 0;
+
+    struct rill_open_stats ignored = {0};
+    if (!stats) stats = &ignored;
+    *stats = (struct rill_open_stats) {0};
+
+    uint64_t t0 = nsecs_now();
+
+    bool missing = false;
+    bool ok = manifest_open_once(
+            dir, flags, pool, list, len, open, open_len, stats, &missing);
+
+    int fd = -1;
+    if (ok && missing && (fd = manifest_lock_shared(dir)) != -1) {
+        for (size_t i = 0; i < *len; ++i) rill_store_close((*list)[i]);
+        free(*list);
+        *list = NULL;
+        *len = 0;
+
+        ok = manifest_open_once(
+                dir, flags, pool, list, len, open, open_len, stats, &missing);
+
+        manifest_unlock(fd);
+    }
+
+    stats->wall_ns = nsecs_now() - t0;
+    return ok;
+}
+
+bool rill_open_dir(
+        const char *dir, unsigned flags,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len)
+{
+    return manifest_open_dir(dir, flags, NULL, list, len, open, open_len, NULL);
+}
+
+bool rill_open_dir_threads(
+        const char *dir, unsigned flags, size_t threads,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len,
+        struct rill_open_stats *stats)
+{
+    struct pool *pool = NULL;
+    if (threads > 1 && !(pool = pool_open(threads))) return false;
+
+    bool ok = manifest_open_dir(dir, flags, pool, list, len, open, open_len, stats);
+
+    if (pool) pool_close(pool);
+    return ok;
+}
+
+size_t rill_scan_dir(const char *dir, struct rill_store **list, size_t cap)
+{
+    size_t len = 0;
+    struct rill_store **all = NULL;
+    if (!rill_open_dir(dir, 0, &all, &len, NULL, 0)) return 0;
+
+    if (len > cap) {
+        rill_fail("too many files in '%s': %lu > %lu", dir, len, cap);
+        for (size_t i = cap; i < len; ++i) rill_store_close(all[i]);
+        len = cap;
+    }
+
+    memcpy(list, all, len * sizeof(all[0]));
+    free(all);
+    return len;
+}
+
+
+// -----------------------------------------------------------------------------
+// manifest
+// -----------------------------------------------------------------------------
+
+// Text format which makes it easy to inspect and repair by hand:
+//
+//     rill-manifest <version>
+//     <ts> <quant> <name>
+//
+// The name goes last as it's the only field that may contain spaces. Version 1
+// also listed the row count and key ranges of the stores which had no readers.
+
+static const char manifest_magic[] = "rill-manifest";
+static const unsigned manifest_version = 2;
+
+static const char manifest_name[] = "MANIFEST";
+static const char manifest_tmp[] = "MANIFEST.tmp";
+static const char manifest_lock_name[] = "MANIFEST.lock";
+
+void manifest_free(struct manifest *manifest)
+{
+    free(manifest->list);
+    *manifest = (struct manifest) {0};
+}
+
+static bool manifest_push(struct manifest *manifest, const struct manifest_entry *entry)
+{
+    if (manifest->len == manifest->cap) {
+        size_t cap = manifest->cap ? manifest->cap * 2 : 64;
+        struct manifest_entry *list = realloc(manifest->list, cap * sizeof(*list));
+        if (!list) {
+            rill_fail("unable to allocate manifest: %lu", cap);
+            return false;
+        }
+
+        manifest->list = list;
+        manifest->cap = cap;
+    }
+
+    manifest->list[manifest->len++] = *entry;
+    return true;
+}
+
+static ssize_t manifest_find(const struct manifest *manifest, const char *name)
+{
+    for (size_t i = 0; i < manifest->len; ++i) {
+        if (!strcmp(manifest->list[i].name, name)) return i;
+    }
+    return -1;
+}
+
+static const char *file_name(const char *file)
+{
+    const char *name = strrchr(file, '/');
+    return name ? name + 1 : file;
+}
+
+static bool manifest_put(
+        struct manifest *manifest, const struct rill_store *store, const char *name)
+{
+    struct manifest_entry entry = {
+        .ts = rill_store_ts(store),
+        .quant = rill_store_quant(store),
+    };
+    snprintf(entry.name, sizeof(entry.name), "%s", name);
+
+    ssize_t i = manifest_find(manifest, entry.name);
+    if (i < 0) return manifest_push(manifest, &entry);
+
+    manifest->list[i] = entry;
+    return true;
+}
+
+static void manifest_del(struct manifest *manifest, const char *name)
+{
+    ssize_t i = manifest_find(manifest, name);
+    if (i < 0) return;
+
+    memmove(manifest->list + i, manifest->list + i + 1,
+            (manifest->len - i - 1) * sizeof(manifest->list[0]));
+    manifest->len--;
+}
+
+static bool manifest_parse(
+        const char *dir, char *data, struct manifest *out)
+{
+    char *save = NULL;
+    char *line = strtok_r(data, "\n", &save);
+
+    char magic[sizeof(manifest_magic)] = {0};
+    unsigned version = 0;
+    if (!line || sscanf(line, "%13s %u", magic, &version) != 2 ||
+            strcmp(magic, manifest_magic)) {
+        rill_fail("invalid manifest header in '%s'", dir);
+        return false;
+    }
+
+    if (version != 1 && version != manifest_version) {
+        rill_fail("invalid manifest version '%u' in '%s'", version, dir);
+        return false;
+    }
+
+    while ((line = strtok_r(NULL, "\n", &save))) {
+        int name = 0;
+        struct manifest_entry entry = {0};
+
+        int ret = version == 1 ?
+            sscanf(line, "%lu %lu %*u %*u %*u %*u %*u %n", &entry.ts, &entry.quant, &name) :
+            sscanf(line, "%lu %lu %n", &entry.ts, &entry.quant, &name);
+
+        if (ret != 2 || !line[name] || strlen(line + name) > NAME_MAX) {
+            rill_fail("invalid manifest entry in '%s': %s", dir, line);
+            return false;
+        }
+
+        strcpy(entry.name, line + name);
+        if (!manifest_push(out, &entry)) return false;
+    }
+
+    return true;
+}
+
+bool manifest_load(const char *dir, struct manifest *out, bool *found)
+{
+    *out = (struct manifest) {0};
+    *found = false;
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%s", dir, manifest_name);
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT) return true;
+        rill_fail_errno("unable to open '%s'", file);
+        goto fail_open;
+    }
+
+    struct stat stat_ret = {0};
+    if (fstat(fd, &stat_ret) == -1) {
+        rill_fail_errno("unable to stat '%s'", file);
+        goto fail_stat;
+    }
+
+    size_t len = stat_ret.st_size;
+    char *data = malloc(len + 1);
+    if (!data) {
+        rill_fail("unable to allocate memory for '%s': %lu", file, len);
+        goto fail_alloc;
+    }
+
+    ssize_t ret = pread(fd, data, len, 0);
+    if (ret == -1 || (size_t) ret != len) {
+        rill_fail_errno("unable to read '%s'", file);
+        goto fail_read;
+    }
+    data[len] = '\0';
+
+    if (!manifest_parse(dir, data, out)) goto fail_parse;
+
+    free(data);
+    close(fd);
+    *found = true;
+    return true;
+
+  fail_parse:
+    manifest_free(out);
+  fail_read:
+    free(data);
+  fail_alloc:
+  fail_stat:
+    close(fd);
+  fail_open:
+    return false;
+}
+
+// Renames are only durable once the directory itself is synced.
+static bool manifest_sync_dir(const char *dir)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        rill_fail_errno("unable to open dir '%s'", dir);
+        return false;
+    }
+
+    bool ok = fsync(fd) != -1;
+    if (!ok) rill_fail_errno("unable to sync dir '%s'", dir);
+
+    close(fd);
+    return ok;
+}
+
+static bool manifest_save(const char *dir, const struct manifest *manifest)
+{
+    char tmp[PATH_MAX], file[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/%s", dir, manifest_tmp);
+    snprintf(file, sizeof(file), "%s/%s", dir, manifest_name);
+
+    FILE *stream = fopen(tmp, "w");
+    if (!stream) {
+        rill_fail_errno("unable to open '%s'", tmp);
+        goto fail_open;
+    }
+
+    fprintf(stream, "%s %u\n", manifest_magic, manifest_version);
+
+    for (size_t i = 0; i < manifest->len; ++i) {
+        const struct manifest_entry *entry = &manifest->list[i];
+        fprintf(stream, "%lu %lu %s\n", entry->ts, entry->quant, entry->name);
+    }
+
+    if (fflush(stream) || fsync(fileno(stream)) == -1) {
+        rill_fail_errno("unable to write '%s'", tmp);
+        goto fail_write;
+    }
+
+    if (fclose(stream)) {
+        stream = NULL;
+        rill_fail_errno("unable to close '%s'", tmp);
+        goto fail_write;
+    }
+    stream = NULL;
+
+    if (rename(tmp, file) == -1) {
+        rill_fail_errno("unable to rename '%s' to '%s'", tmp, file);
+        goto fail_write;
+    }
+
+    return true;
+
+  fail_write:
+    if (stream) fclose(stream);
+    unlink(tmp);
+  fail_open:
+    return false;
+}
+
+// Writers of the manifest can live in different processes so the lock is an
+// flock on a dedicated file as the manifest itself is replaced on every write.
+static int manifest_lock(const char *dir)
+{
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%s", dir, manifest_lock_name);
+
+    int fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        rill_fail_errno("unable to open '%s'", file);
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX) == -1) {
+        rill_fail_errno("unable to acquire flock on '%s'", file);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int manifest_lock_shared(const char *dir)
+{
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%s", dir, manifest_lock_name);
+
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    if (flock(fd, LOCK_SH) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void manifest_unlock(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static bool manifest_scan(const char *dir, struct manifest *out)
+{
+    size_t len = 0;
+    struct rill_store **list = NULL;
+    struct scan_dir scan = { .dir = dir };
+
+    bool ok = scan_dir_readdir(&scan) &&
+        scan_dir_open(&scan, NULL, &list, &len, NULL, 0);
+
+    for (size_t i = 0; i < len; ++i) {
+        if (ok) ok = manifest_put(out, list[i], file_name(rill_store_file(list[i])));
+        rill_store_close(list[i]);
+    }
+
+    free(list);
+    scan_dir_free(&scan);
+    return ok;
+}
+
+void manifest_pending(const char *file, char *out, size_t len)
+{
+    snprintf(out, len, "%s%s", file, pending_ext);
+}
+
+// Finishes the work of the updates that were interrupted by a crash. Updates
+// only rename and unlink files while holding the lock so anything found here
+// is a leftover. Stores set aside for removal are put back unless the manifest
+// that drops them was saved. Stores that were published but not yet renamed
+// into place are renamed. Pending files of other stores may belong to writers
+// that are still running and are left alone.
+static bool manifest_recover(
+        const char *dir, const struct manifest *manifest, bool found)
+{
+    DIR *dir_handle = opendir(dir);
+    if (!dir_handle) {
+        rill_fail_errno("unable to open dir '%s'", dir);
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent *entry = NULL;
+    while (ok && (entry = readdir(dir_handle))) {
+        const char *ext = NULL;
+        if (has_ext(entry->d_name, removed_ext)) ext = removed_ext;
+        else if (has_ext(entry->d_name, pending_ext)) ext = pending_ext;
+        else continue;
+
+        char name[NAME_MAX + 1];
+        snprintf(name, sizeof(name), "%.*s",
+                (int) (strlen(entry->d_name) - strlen(ext)), entry->d_name);
+        bool listed = found && manifest_find(manifest, name) >= 0;
+
+        char from[PATH_MAX], to[PATH_MAX];
+        snprintf(from, sizeof(from), "%s/%s", dir, entry->d_name);
+        snprintf(to, sizeof(to), "%s/%s", dir, name);
+
+        if (ext == pending_ext) {
+            if (!listed || !access(to, F_OK)) continue;
+        }
+        else if (found && !listed) {
+            if (unlink(from) == -1) {
+                rill_fail_errno("unable to unlink '%s'", from);
+                ok = false;
+            }
+            continue;
+        }
+
+        if (rename(from, to) == -1) {
+            rill_fail_errno("unable to rename '%s' to '%s'", from, to);
+            ok = false;
+        }
+    }
+
+    closedir(dir_handle);
+    return ok;
+}
+
+// Loads the manifest of dir or builds it from the directory if it doesn't
+// exist yet. Must be called while holding the manifest lock.
+static bool manifest_read(const char *dir, struct manifest *out)
+{
+    bool found = false;
+    if (!manifest_load(dir, out, &found)) return false;
+    if (!manifest_recover(dir, out, found)) goto fail;
+    if (!found && !manifest_scan(dir, out)) goto fail;
+    return true;
+
+  fail:
+    manifest_free(out);
+    return false;
+}
+
+bool manifest_list(const char *dir, struct manifest *out)
+{
+    int fd = manifest_lock(dir);
+    if (fd == -1) return false;
+
+    bool ok = manifest_read(dir, out);
+    manifest_unlock(fd);
+    return ok;
+}
+
+// Stores to remove are first set aside under a name that's never read and are
+// only unlinked once the manifest that drops them is saved. The new store is
+// similarly only renamed into place once it's listed. A crash at any point is
+// recovered by the next update which means that a store is never both listed
+// and removed nor present without being listed.
+bool manifest_update(
+        const char *dir, const char *file,
+        const char *const *rm, size_t rm_len)
+{
+    char pending[PATH_MAX] = {0};
+    if (file) manifest_pending(file, pending, sizeof(pending));
+
+    int fd = manifest_lock(dir);
+    if (fd == -1) goto fail_lock;
+
+    struct manifest manifest = {0};
+    if (!manifest_read(dir, &manifest)) goto fail_read;
+
+    if (file) {
+        struct rill_store *store = rill_store_open(pending);
+        if (!store) goto fail_put;
+
+        bool ok = manifest_put(&manifest, store, file_name(file));
+        rill_store_close(store);
+        if (!ok) goto fail_put;
+    }
+
+    size_t removed = 0;
+    for (; removed < rm_len; ++removed) {
+        char aside[PATH_MAX];
+        snprintf(aside, sizeof(aside), "%s%s", rm[removed], removed_ext);
+
+        if (rename(rm[removed], aside) == -1) {
+            rill_fail_errno("unable to rename '%s' to '%s'", rm[removed], aside);
+            goto fail_rm;
+        }
+        manifest_del(&manifest, file_name(rm[removed]));
+    }
+
+    if (!manifest_save(dir, &manifest)) goto fail_rm;
+
+    // The store is part of the manifest from this point on so failures are
+    // left to the recovery of the next update. They're still reported as the
+    // update isn't durable until both renames were synced.
+    bool ok = manifest_sync_dir(dir);
+
+    if (file && rename(pending, file) == -1) {
+        rill_fail_errno("unable to rename '%s' to '%s'", pending, file);
+        ok = false;
+    }
+    else if (file && !manifest_sync_dir(dir)) ok = false;
+
+    for (size_t i = 0; i < rm_len; ++i) {
+        char aside[PATH_MAX];
+        snprintf(aside, sizeof(aside), "%s%s", rm[i], removed_ext);
+        if (unlink(aside) == -1) rill_fail_errno("unable to unlink '%s'", aside);
+    }
+
+    manifest_free(&manifest);
+    manifest_unlock(fd);
+    return ok;
+
+  fail_rm:
+    for (size_t i = 0; i < removed; ++i) {
+        char aside[PATH_MAX];
+        snprintf(aside, sizeof(aside), "%s%s", rm[i], removed_ext);
+        rename(aside, rm[i]);
+    }
+  fail_put:
+    manifest_free(&manifest);
+  fail_read:
+    manifest_unlock(fd);
+  fail_lock:
+    if (file) unlink(pending);
+    return false;
+}
+
+bool rill_manifest_rebuild(const char *dir)
+{
+    int fd = manifest_lock(dir);
+    if (fd == -1) return false;
+
+    bool found = false;
+    struct manifest manifest = {0};
+    bool ok = manifest_load(dir, &manifest, &found) &&
+        manifest_recover(dir, &manifest, found);
+    manifest_free(&manifest);
+
+    if (ok) ok = manifest_scan(dir, &manifest) && manifest_save(dir, &manifest) &&
+                manifest_sync_dir(dir);
+
+    manifest_free(&manifest);
+    manifest_unlock(fd);
+    return ok;
+}
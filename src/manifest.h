@@ -0,0 +1,65 @@
+/* manifest.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+#include "rill.h"
+
+#include <limits.h>
+
+struct pool;
+
+
+// -----------------------------------------------------------------------------
+// manifest
+// -----------------------------------------------------------------------------
+
+// List of the stores of a directory along with enough of their metadata to
+// reason about them without having to open them. The file is always replaced
+// atomically and updates are serialized through a lock file so readers only
+// lock to wait out an update that removed a store they listed.
+
+struct manifest_entry
+{
+    char name[NAME_MAX + 1];
+    rill_ts_t ts;
+    rill_ts_t quant;
+};
+
+struct manifest
+{
+    size_t len, cap;
+    struct manifest_entry *list;
+};
+
+void manifest_free(struct manifest *);
+
+// found is set to false if the directory doesn't have a manifest.
+bool manifest_load(const char *dir, struct manifest *out, bool *found);
+
+// Same as manifest_load but the manifest is built from the content of the
+// directory if it doesn't exist and the updates that were interrupted by a
+// crash are first recovered.
+bool manifest_list(const char *dir, struct manifest *out);
+
+// New stores must be written to their pending file until they're published by
+// manifest_update.
+void manifest_pending(const char *file, char *out, size_t len);
+
+// Publishes the store written to the pending file of file, unless file is NULL,
+// and removes the stores in rm from the manifest of dir and from the disk. The
+// manifest is first built from the content of the directory if it doesn't
+// exist yet. The pending file is removed on failure.
+bool manifest_update(
+        const char *dir, const char *file,
+        const char *const *rm, size_t rm_len);
+
+// Opens the stores of dir as rill_open_dir does but over the threads of pool
+// which may be NULL. stats may be NULL.
+bool manifest_open_dir(
+        const char *dir, unsigned flags, struct pool *pool,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len,
+        struct rill_open_stats *stats);
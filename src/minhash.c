@@ -0,0 +1,171 @@
+/* minhash.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// -----------------------------------------------------------------------------
+// minhash
+// -----------------------------------------------------------------------------
+
+// MinHash signatures of the values of the keys in column a along with an LSH
+// index over the bands of the signatures. Keys that share all the rows of any
+// band land in the same bucket of that band which makes it possible to find
+// keys with similar values without going through every signature.
+//
+// With 8 bands of 4 rows, keys with a Jaccard similarity of 0.5 have a ~40%
+// chance of being a candidate while those at 0.8 sit at ~97%.
+//
+// The section is made of the sorted index positions of the signed keys
+// followed by their signatures and finally by the entries of each band sorted
+// by their hash.
+
+enum
+{
+    minhash_hashes = 32,
+    minhash_bands = 8,
+    minhash_band_rows = minhash_hashes / minhash_bands,
+    minhash_min_degree = 8,
+};
+
+static const uint64_t minhash_seed = 0x4D484153;
+
+struct rill_packed minhash_entry
+{
+    uint64_t hash;
+    uint64_t idx; // position in the list of keys.
+};
+
+struct rill_packed minhash
+{
+    uint64_t len;
+    uint64_t __unused;
+
+    // followed by the signatures: uint32_t[len][minhash_hashes]
+    // followed by the bands: struct minhash_entry[minhash_bands][len]
+    uint64_t keys[];
+};
+
+static size_t minhash_bytes(size_t keys)
+{
+    return sizeof(struct minhash) + keys * (
+            sizeof(uint64_t) +
+            minhash_hashes * sizeof(uint32_t) +
+            minhash_bands * sizeof(struct minhash_entry));
+}
+
+static size_t minhash_cap(size_t rows)
+{
+    return minhash_bytes(rows / minhash_min_degree);
+}
+
+static size_t minhash_len(struct minhash *minhash)
+{
+    return minhash_bytes(minhash->len);
+}
+
+static inline uint32_t *minhash_sig(struct minhash *minhash, size_t i)
+{
+    return (uint32_t *) (minhash->keys + minhash->len) + i * minhash_hashes;
+}
+
+static inline struct minhash_entry *minhash_band(struct minhash *minhash, size_t band)
+{
+    struct minhash_entry *bands = (void *) minhash_sig(minhash, minhash->len);
+    return bands + band * minhash->len;
+}
+
+static void minhash_reset(uint32_t *sig)
+{
+    memset(sig, 0xFF, minhash_hashes * sizeof(*sig));
+}
+
+// All the hashes are derived from a single hash of the value (Kirsch and
+// Mitzenmacher) which is good enough for MinHash and a lot cheaper.
+static inline void minhash_add(uint32_t *sig, rill_val_t val)
+{
+    uint64_t hash = mph_hash(val, minhash_seed);
+    uint32_t h1 = hash, h2 = (hash >> 32) | 1;
+
+    for (size_t i = 0; i < minhash_hashes; ++i) {
+        uint32_t h = h1 + i * h2;
+        if (h < sig[i]) sig[i] = h;
+    }
+}
+
+static void minhash_union(uint32_t *sig, const uint32_t *other)
+{
+    for (size_t i = 0; i < minhash_hashes; ++i)
+        if (other[i] < sig[i]) sig[i] = other[i];
+}
+
+static uint64_t minhash_band_hash(const uint32_t *sig, size_t band)
+{
+    const uint32_t *rows = sig + band * minhash_band_rows;
+
+    uint64_t hash = band;
+    for (size_t i = 0; i < minhash_band_rows; i += 2) {
+        uint64_t word = ((uint64_t) rows[i] << 32) | rows[i + 1];
+        hash = mph_hash(hash ^ word, minhash_seed);
+    }
+    return hash;
+}
+
+static int minhash_entry_cmp(const void *l, const void *r)
+{
+    const struct minhash_entry *lhs = l, *rhs = r;
+    if (lhs->hash < rhs->hash) return -1;
+    if (lhs->hash > rhs->hash) return +1;
+    if (lhs->idx < rhs->idx) return -1;
+    if (lhs->idx > rhs->idx) return +1;
+    return 0;
+}
+
+// Expects the keys and signatures to be filled in.
+static void minhash_index(struct minhash *minhash)
+{
+    for (size_t band = 0; band < minhash_bands; ++band) {
+        struct minhash_entry *entries = minhash_band(minhash, band);
+
+        for (size_t i = 0; i < minhash->len; ++i) {
+            entries[i] = (struct minhash_entry) {
+                .hash = minhash_band_hash(minhash_sig(minhash, i), band),
+                .idx = i,
+            };
+        }
+
+        qsort(entries, minhash->len, sizeof(entries[0]), minhash_entry_cmp);
+    }
+}
+
+static uint32_t *minhash_find(struct minhash *minhash, size_t key_idx)
+{
+    size_t low = 0, high = minhash->len;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (minhash->keys[mid] < key_idx) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low == minhash->len || minhash->keys[low] != key_idx) return NULL;
+    return minhash_sig(minhash, low);
+}
+
+// Range of the entries of band that match the hash.
+static struct minhash_entry *minhash_bucket(
+        struct minhash *minhash, size_t band, uint64_t hash, size_t *len)
+{
+    struct minhash_entry *entries = minhash_band(minhash, band);
+
+    size_t low = 0, high = minhash->len;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (entries[mid].hash < hash) low = mid + 1;
+        else high = mid;
+    }
+
+    size_t end = low;
+    while (end < minhash->len && entries[end].hash == hash) end++;
+
+    *len = end - low;
+    return entries + low;
+}
@@ -0,0 +1,288 @@
+/* mph.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+// -----------------------------------------------------------------------------
+// mph
+// -----------------------------------------------------------------------------
+
+// Minimal perfect hash over the keys of a column loosely based on PTHash. Keys
+// are hashed into buckets which are then placed, largest first, by searching
+// for a pilot value that sends every key of the bucket into a free slot.
+// Buckets containing a single key don't go through the search and are instead
+// assigned directly to whatever slots are left which keeps the table minimal
+// without paying for the usual tail search.
+//
+// Each slot holds the position of its key in the index along with a
+// fingerprint of the key's hash so that most absent keys can be rejected
+// without touching the index.
+
+enum
+{
+    mph_bucket_keys = 2,
+    mph_seeds = 16,
+    mph_pilot_max = 1 << 20,
+};
+
+static const uint32_t mph_direct = 1U << 31;
+
+struct rill_packed mph_slot
+{
+    uint32_t idx;
+    uint32_t fp;
+};
+
+struct rill_packed mph
+{
+    uint64_t len;
+    uint64_t buckets;
+    uint64_t seed;
+    uint64_t __unused;
+
+    // followed by the pilots of each bucket: uint32_t[buckets]
+    struct mph_slot slots[];
+};
+
+static size_t mph_buckets(size_t len)
+{
+    return len / mph_bucket_keys + 1;
+}
+
+static size_t mph_cap(size_t len)
+{
+    return sizeof(struct mph)
+        + len * sizeof(struct mph_slot)
+        + mph_buckets(len) * sizeof(uint32_t);
+}
+
+static inline uint32_t *mph_pilots(struct mph *mph)
+{
+    return (uint32_t *) (mph->slots + mph->len);
+}
+
+// murmur3's fmix64 finalizer.
+static inline uint64_t mph_hash(uint64_t key, uint64_t seed)
+{
+    uint64_t hash = key ^ (seed * 0x9E3779B97F4A7C15UL);
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53UL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static inline size_t mph_range(uint64_t hash, size_t len)
+{
+    return ((unsigned __int128) hash * len) >> 64;
+}
+
+static inline size_t mph_slot(uint64_t hash, uint32_t pilot, size_t len)
+{
+    if (pilot & mph_direct) return pilot & ~mph_direct;
+    return mph_range(mph_hash(hash, pilot), len);
+}
+
+static bool mph_find(struct mph *mph, rill_val_t key, size_t *key_idx)
+{
+    if (rill_unlikely(!mph->len)) return false;
+
+    uint64_t hash = mph_hash(key, mph->seed);
+    uint32_t pilot = mph_pilots(mph)[mph_range(hash, mph->buckets)];
+
+    size_t slot = mph_slot(hash, pilot, mph->len);
+    if (rill_unlikely(slot >= mph->len)) return false;
+
+    struct mph_slot *entry = &mph->slots[slot];
+    if (entry->fp != (uint32_t) hash) return false;
+
+    *key_idx = entry->idx;
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// build
+// -----------------------------------------------------------------------------
+
+struct mph_builder
+{
+    size_t len;
+    const rill_val_t *keys;
+
+    uint64_t *hashes;
+    size_t *keys_by_bucket;
+    size_t *bucket_start;
+    size_t *buckets_by_size;
+    uint64_t *taken;
+};
+
+static inline bool mph_taken(struct mph_builder *builder, size_t slot)
+{
+    return builder->taken[slot / 64] & (1UL << (slot % 64));
+}
+
+static inline void mph_take(struct mph_builder *builder, size_t slot)
+{
+    builder->taken[slot / 64] |= 1UL << (slot % 64);
+}
+
+static bool mph_place_bucket(
+        struct mph *mph, struct mph_builder *builder, size_t bucket)
+{
+    size_t start = builder->bucket_start[bucket];
+    size_t len = builder->bucket_start[bucket + 1] - start;
+    const size_t *keys = builder->keys_by_bucket + start;
+
+    size_t slots[len];
+
+    for (uint32_t pilot = 0; pilot < mph_pilot_max; ++pilot) {
+        size_t i = 0;
+        for (; i < len; ++i) {
+            slots[i] = mph_slot(builder->hashes[keys[i]], pilot, mph->len);
+            if (mph_taken(builder, slots[i])) break;
+
+            size_t j = 0;
+            while (j < i && slots[j] != slots[i]) j++;
+            if (j < i) break;
+        }
+        if (i < len) continue;
+
+        for (i = 0; i < len; ++i) {
+            mph_take(builder, slots[i]);
+            mph->slots[slots[i]] = (struct mph_slot) {
+                .idx = keys[i],
+                .fp = builder->hashes[keys[i]],
+            };
+        }
+
+        mph_pilots(mph)[bucket] = pilot;
+        return true;
+    }
+
+    return false;
+}
+
+static bool mph_place(struct mph *mph, struct mph_builder *builder)
+{
+    size_t buckets = mph->buckets;
+
+    memset(builder->bucket_start, 0, (buckets + 1) * sizeof(size_t));
+    memset(builder->taken, 0, (mph->len / 64 + 1) * sizeof(uint64_t));
+    memset(mph_pilots(mph), 0, buckets * sizeof(uint32_t));
+
+    // counting sort of the keys by bucket.
+    size_t max_size = 0;
+    for (size_t i = 0; i < builder->len; ++i) {
+        builder->hashes[i] = mph_hash(builder->keys[i], mph->seed);
+        size_t bucket = mph_range(builder->hashes[i], buckets);
+
+        size_t size = ++builder->bucket_start[bucket + 1];
+        if (size > max_size) max_size = size;
+    }
+
+    for (size_t i = 0; i < buckets; ++i)
+        builder->bucket_start[i + 1] += builder->bucket_start[i];
+
+    {
+        // buckets_by_size isn't in use yet so it doubles as scratch space.
+        size_t *pos = builder->buckets_by_size;
+        memcpy(pos, builder->bucket_start, buckets * sizeof(pos[0]));
+
+        for (size_t i = 0; i < builder->len; ++i) {
+            size_t bucket = mph_range(builder->hashes[i], buckets);
+            builder->keys_by_bucket[pos[bucket]++] = i;
+        }
+    }
+
+    // counting sort of the buckets by decreasing size.
+    {
+        size_t pos[max_size + 2];
+        memset(pos, 0, sizeof(pos));
+
+        for (size_t i = 0; i < buckets; ++i) {
+            size_t size = builder->bucket_start[i + 1] - builder->bucket_start[i];
+            pos[max_size - size + 1]++;
+        }
+
+        for (size_t i = 0; i <= max_size; ++i) pos[i + 1] += pos[i];
+
+        for (size_t i = 0; i < buckets; ++i) {
+            size_t size = builder->bucket_start[i + 1] - builder->bucket_start[i];
+            builder->buckets_by_size[pos[max_size - size]++] = i;
+        }
+    }
+
+    size_t i = 0;
+    for (; i < buckets; ++i) {
+        size_t bucket = builder->buckets_by_size[i];
+        size_t size = builder->bucket_start[bucket + 1] - builder->bucket_start[bucket];
+        if (size < 2) break;
+
+        if (!mph_place_bucket(mph, builder, bucket)) return false;
+    }
+
+    size_t slot = 0;
+    for (; i < buckets; ++i) {
+        size_t bucket = builder->buckets_by_size[i];
+        size_t start = builder->bucket_start[bucket];
+        if (builder->bucket_start[bucket + 1] == start) break;
+
+        while (mph_taken(builder, slot)) slot++;
+        mph_take(builder, slot);
+
+        size_t key = builder->keys_by_bucket[start];
+        mph->slots[slot] = (struct mph_slot) {
+            .idx = key,
+            .fp = builder->hashes[key],
+        };
+        mph_pilots(mph)[bucket] = mph_direct | slot;
+    }
+
+    return true;
+}
+
+// Keys must be unique and are identified by their position in the list which
+// is expected to match their position in the index.
+static bool mph_build(struct mph *mph, const rill_val_t *keys, size_t len)
+{
+    if (len >= mph_direct) {
+        rill_fail("too many keys for mph: %lu", len);
+        return false;
+    }
+
+    *mph = (struct mph) { .len = len, .buckets = mph_buckets(len) };
+
+    struct mph_builder builder = {
+        .len = len,
+        .keys = keys,
+        .hashes = calloc(len + 1, sizeof(uint64_t)),
+        .keys_by_bucket = calloc(len + 1, sizeof(size_t)),
+        .bucket_start = calloc(mph->buckets + 1, sizeof(size_t)),
+        .buckets_by_size = calloc(mph->buckets, sizeof(size_t)),
+        .taken = calloc(len / 64 + 1, sizeof(uint64_t)),
+    };
+
+    bool ok = false;
+    if (!builder.hashes || !builder.keys_by_bucket || !builder.bucket_start ||
+            !builder.buckets_by_size || !builder.taken) {
+        rill_fail("unable to allocate memory for mph: %lu", len);
+        goto done;
+    }
+
+    for (size_t seed = 0; !ok && seed < mph_seeds; ++seed) {
+        mph->seed = seed;
+        ok = mph_place(mph, &builder);
+    }
+
+    if (!ok) rill_fail("unable to build mph: %lu", len);
+
+  done:
+    free(builder.hashes);
+    free(builder.keys_by_bucket);
+    free(builder.bucket_start);
+    free(builder.buckets_by_size);
+    free(builder.taken);
+    return ok;
+}
@@ -0,0 +1,216 @@
+/* pool.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "pool.h"
+#include "rill.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+// -----------------------------------------------------------------------------
+// struct
+// -----------------------------------------------------------------------------
+
+struct pool
+{
+    size_t refs;
+    size_t threads;
+    size_t spawned;
+    pthread_t *workers;
+
+    pthread_mutex_t run_lock;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+
+    bool stop;
+    size_t generation;
+    size_t active;
+
+    pool_fn_t fn;
+    void *ctx;
+    size_t tasks;
+    atomic_size_t next;
+
+    bool failed;
+    struct rill_error error;
+};
+
+struct pool_worker
+{
+    struct pool *pool;
+    size_t id;
+};
+
+
+// -----------------------------------------------------------------------------
+// work
+// -----------------------------------------------------------------------------
+
+static void pool_work(struct pool *pool, size_t worker)
+{
+    size_t task = 0;
+    while ((task = atomic_fetch_add(&pool->next, 1)) < pool->tasks) {
+        if (pool->fn(pool->ctx, worker, task)) continue;
+
+        pthread_mutex_lock(&pool->lock);
+        if (!pool->failed) {
+            pool->failed = true;
+            pool->error = rill_errno;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *pool_worker_main(void *arg)
+{
+    struct pool_worker worker = *((struct pool_worker *) arg);
+    struct pool *pool = worker.pool;
+    free(arg);
+
+    // The pool always starts at generation 0 and can't move past 1 until every
+    // worker took part in it.
+    size_t generation = 0;
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (!pool->stop && pool->generation == generation)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stop) break;
+
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, worker.id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->active) pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// pool
+// -----------------------------------------------------------------------------
+
+struct pool *pool_open(size_t threads)
+{
+    if (!threads) threads = 1;
+
+    struct pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        rill_fail("unable to allocate pool");
+        goto fail_alloc_struct;
+    }
+
+    pool->refs = 1;
+    pool->threads = threads;
+    pool->workers = calloc(threads, sizeof(pool->workers[0]));
+    if (!pool->workers) {
+        rill_fail("unable to allocate pool workers: %lu", threads);
+        goto fail_alloc_workers;
+    }
+
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // The calling thread acts as the last worker.
+    for (; pool->spawned + 1 < threads; pool->spawned++) {
+        struct pool_worker *worker = calloc(1, sizeof(*worker));
+        if (!worker) {
+            rill_fail("unable to allocate pool worker");
+            goto fail_spawn;
+        }
+        *worker = (struct pool_worker) { .pool = pool, .id = pool->spawned };
+
+        int err = pthread_create(
+                &pool->workers[pool->spawned], NULL, pool_worker_main, worker);
+        if (err) {
+            free(worker);
+            errno = err;
+            rill_fail_errno("unable to spawn pool worker");
+            goto fail_spawn;
+        }
+    }
+
+    return pool;
+
+  fail_spawn:
+    pool_close(pool);
+    return NULL;
+
+  fail_alloc_workers:
+    free(pool);
+  fail_alloc_struct:
+    return NULL;
+}
+
+struct pool *pool_ref(struct pool *pool)
+{
+    __atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+    return pool;
+}
+
+void pool_close(struct pool *pool)
+{
+    if (__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL)) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->spawned; ++i)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+
+    free(pool->workers);
+    free(pool);
+}
+
+size_t pool_threads(const struct pool *pool)
+{
+    return pool->threads;
+}
+
+bool pool_run(struct pool *pool, size_t tasks, pool_fn_t fn, void *ctx)
+{
+    pthread_mutex_lock(&pool->run_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->tasks = tasks;
+    atomic_store(&pool->next, 0);
+    pool->failed = false;
+    pool->active = pool->spawned;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, pool->threads - 1);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active) pthread_cond_wait(&pool->done, &pool->lock);
+    bool ok = !pool->failed;
+    if (!ok) rill_errno = pool->error;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->run_lock);
+    return ok;
+}
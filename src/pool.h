@@ -0,0 +1,37 @@
+/* pool.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+// -----------------------------------------------------------------------------
+// pool
+// -----------------------------------------------------------------------------
+
+// Fixed set of worker threads used to fan out a batch of independent tasks.
+// The calling thread takes part in the work so a pool of n threads only spawns
+// n - 1 workers. Callers are serialized so a pool can safely be shared.
+//
+// Pools are refcounted: every ref must be matched by a pool_close and the
+// workers are only joined once the last one goes away.
+
+struct pool;
+
+// worker is in [0, pool_threads()) and is unique among the tasks running
+// concurrently which makes it usable to index per-worker state.
+typedef bool (*pool_fn_t) (void *ctx, size_t worker, size_t task);
+
+struct pool *pool_open(size_t threads);
+struct pool *pool_ref(struct pool *);
+void pool_close(struct pool *);
+
+size_t pool_threads(const struct pool *);
+
+// Returns false if any of the tasks failed in which case rill_errno is set to
+// the error of the first failure. Remaining tasks are still executed.
+bool pool_run(struct pool *, size_t tasks, pool_fn_t fn, void *ctx);
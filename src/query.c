@@ -5,29 +5,153 @@
 
 #include "rill.h"
 #include "utils.h"
+#include "pool.h"
+#include "set.h"
+#include "cache.h"
+#include "manifest.h"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 
 
 // -----------------------------------------------------------------------------
 // rill
 // -----------------------------------------------------------------------------
 
+// Snapshot of the stores of a query. Queries hold a ref on the snapshot for
+// their whole duration which lets rill_query_refresh swap in a new one without
+// having to wait on them. Stores are closed along with the last snapshot that
+// references them.
+struct query_set
+{
+    size_t refs;
+    size_t gen;
+
+    // sorted from the most recent to the oldest store which is also the order
+    // in which they're made resident.
+    size_t len;
+    struct rill_store **list;
+};
+
 struct rill_query
 {
     const char *dir;
+    unsigned flags;
+    struct pool *pool;
+    struct cache *cache;
+    bool snapshot;
 
-    size_t len;
-    struct rill_store *list[1024];
+    // Readers announce themselves in the counter of the current epoch while
+    // they pin the set. Publishing a new set bumps the epoch and waits for the
+    // readers of the previous one to clear out before dropping the old set
+    // which keeps locks off the read path.
+    size_t epoch;
+    size_t readers[2];
+    struct query_set *set;
+
+    pthread_mutex_t refresh_lock;
+    struct rill_open_stats open_stats;
+    size_t resident;
 };
 
+static int store_cmp(const void *l, const void *r)
+{
+    const struct rill_store *const *lhs = l;
+    const struct rill_store *const *rhs = r;
+
+    if (rill_store_ts(*lhs) < rill_store_ts(*rhs)) return +1;
+    if (rill_store_ts(*lhs) > rill_store_ts(*rhs)) return -1;
+    return 0;
+}
+
+// Stores of prev that are still in the directory are reused instead of being
+// reopened.
+static struct query_set *query_set_scan(
+        const char *dir, unsigned flags, struct pool *pool,
+        const struct query_set *prev, struct rill_open_stats *stats)
+{
+    struct query_set *set = calloc(1, sizeof(*set));
+    if (!set) {
+        rill_fail("unable to allocate memory for '%s'", dir);
+        return NULL;
+    }
+
+    set->refs = 1;
+    set->gen = prev ? prev->gen + 1 : 0;
+
+    bool ok = manifest_open_dir(dir, flags, pool, &set->list, &set->len,
+            prev ? prev->list : NULL, prev ? prev->len : 0, stats);
+    if (!ok) {
+        free(set);
+        return NULL;
+    }
+
+    qsort(set->list, set->len, sizeof(set->list[0]), store_cmp);
+    return set;
+}
+
+static struct query_set *query_acquire(const struct rill_query *query)
+{
+    while (true) {
+        size_t epoch = __atomic_load_n(&query->epoch, __ATOMIC_SEQ_CST);
+        size_t *readers = (size_t *) &query->readers[epoch % 2];
+
+        __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&query->epoch, __ATOMIC_SEQ_CST) != epoch) {
+            __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        struct query_set *set = __atomic_load_n(&query->set, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&set->refs, 1, __ATOMIC_RELAXED);
+
+        __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+        return set;
+    }
+}
+
+static void query_release(struct query_set *set)
+{
+    if (__atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL)) return;
+
+    for (size_t i = 0; i < set->len; ++i)
+        rill_store_close(set->list[i]);
+    free(set->list);
+    free(set);
+}
+
+// Must be serialized with other publishers.
+static void query_publish(struct rill_query *query, struct query_set *set)
+{
+    struct query_set *old = __atomic_exchange_n(&query->set, set, __ATOMIC_SEQ_CST);
+    size_t epoch = __atomic_fetch_add(&query->epoch, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&query->readers[epoch % 2], __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    query_release(old);
+}
+
 struct rill_query * rill_query_open(const char *dir)
+{
+    return rill_query_open_flags(dir, 0);
+}
+
+struct rill_query * rill_query_open_flags(const char *dir, unsigned flags)
+{
+    return rill_query_open_threads(dir, flags, 0);
+}
+
+struct rill_query * rill_query_open_threads(
+        const char *dir, unsigned flags, size_t threads)
 {
     struct rill_query *query = calloc(1, sizeof(*query));
     if (!query) {
@@ -41,11 +165,19 @@ struct rill_query * rill_query_open(const char *dir)
         goto fail_alloc_dir;
     }
 
-    size_t cap = sizeof(query->list) / sizeof(query->list[0]);
-    query->len = rill_scan_dir(query->dir, query->list, cap);
+    query->flags = flags;
+    if (threads > 1 && !(query->pool = pool_open(threads))) goto fail_pool;
+
+    query->set = query_set_scan(
+            query->dir, flags, query->pool, NULL, &query->open_stats);
+    if (!query->set) goto fail_scan;
 
+    pthread_mutex_init(&query->refresh_lock, NULL);
     return query;
 
+  fail_scan:
+    if (query->pool) pool_close(query->pool);
+  fail_pool:
     free((char *) query->dir);
   fail_alloc_dir:
     free(query);
@@ -55,45 +187,1360 @@ struct rill_query * rill_query_open(const char *dir)
 
 void rill_query_close(struct rill_query *query)
 {
-    for (size_t i = 0; i < query->len; ++i)
-        rill_store_close(query->list[i]);
+    query_release(query->set);
 
+    if (query->pool) pool_close(query->pool);
+    if (!query->snapshot && query->cache) cache_close(query->cache);
+
+    pthread_mutex_destroy(&query->refresh_lock);
     free((char *) query->dir);
     free(query);
 }
 
-bool rill_query_key(
-        const struct rill_query *query,
-        enum rill_col col,
-        rill_val_t key,
-        struct rill_rows *out)
+struct rill_query *rill_query_snapshot(const struct rill_query *query)
 {
-    if (!key) return false;
+    struct rill_query *snapshot = calloc(1, sizeof(*snapshot));
+    if (!snapshot) {
+        rill_fail("unable to allocate memory for snapshot of '%s'", query->dir);
+        goto fail_alloc_struct;
+    }
 
-    for (size_t i = 0; i < query->len; ++i) {
-        if (!rill_store_query(query->list[i], col, key, out))
-            return false;
+    snapshot->dir = strndup(query->dir, PATH_MAX);
+    if (!snapshot->dir) {
+        rill_fail("unable to allocate memory for snapshot of '%s'", query->dir);
+        goto fail_alloc_dir;
+    }
+
+    // The pool is shared with the query which may replace it at any time.
+    snapshot->snapshot = true;
+    snapshot->pool = query->pool ? pool_ref(query->pool) : NULL;
+    snapshot->set = query_acquire(query);
+    pthread_mutex_init(&snapshot->refresh_lock, NULL);
+    return snapshot;
+
+  fail_alloc_dir:
+    free(snapshot);
+  fail_alloc_struct:
+    return NULL;
+}
+
+static bool query_set_has(const struct query_set *set, const struct rill_store *store)
+{
+    for (size_t i = 0; i < set->len; ++i) {
+        if (set->list[i] == store) return true;
+    }
+    return false;
+}
+
+// Stores are made resident newest first. Stores shared with prev are skipped
+// as they may be in use by queries that are still running on it.
+static bool query_set_resident(
+        const struct query_set *set, const struct query_set *prev, size_t budget)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < set->len; ++i)
+        used += rill_store_resident_bytes(set->list[i]);
+
+    for (size_t i = 0; i < set->len && used < budget; ++i) {
+        struct rill_store *store = set->list[i];
+        if (rill_store_resident_bytes(store)) continue;
+        if (prev && query_set_has(prev, store)) continue;
+
+        size_t len = rill_store_lookup_bytes(store);
+        if (used + len > budget) continue;
+
+        if (!rill_store_resident(store)) return false;
+        used += len;
     }
 
-    rill_rows_compact(out);
     return true;
 }
 
-bool rill_query_keys(
-        const struct rill_query *query,
+// Cached rows of any key present in a store that was added or dropped are
+// stale. The cache is moved to the new generation before the swap so that
+// queries still running on the old snapshot can't put their rows back in.
+static void query_refresh_cache(
+        struct cache *cache, const struct query_set *old, const struct query_set *set)
+{
+    struct rill_store **changed = calloc(set->len + old->len + 1, sizeof(*changed));
+    if (!changed) {
+        // Checking every store is slower but gets to the same result.
+        cache_invalidate(cache, set->gen, set->list, set->len);
+        cache_invalidate(cache, set->gen, old->list, old->len);
+        return;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < set->len; ++i) {
+        if (!query_set_has(old, set->list[i])) changed[len++] = set->list[i];
+    }
+
+    for (size_t i = 0; i < old->len; ++i) {
+        if (!query_set_has(set, old->list[i])) changed[len++] = old->list[i];
+    }
+
+    cache_invalidate(cache, set->gen, changed, len);
+    free(changed);
+}
+
+bool rill_query_refresh(struct rill_query *query)
+{
+    if (query->snapshot) {
+        rill_fail("unable to refresh a snapshot of '%s'", query->dir);
+        return false;
+    }
+
+    pthread_mutex_lock(&query->refresh_lock);
+    struct query_set *old = query->set;
+
+    struct rill_open_stats stats = {0};
+    struct query_set *set = query_set_scan(
+            query->dir, query->flags, query->pool, old, &stats);
+    if (!set) {
+        pthread_mutex_unlock(&query->refresh_lock);
+        return false;
+    }
+
+    query->open_stats = stats;
+
+    if (query->resident && !query_set_resident(set, old, query->resident)) {
+        query_release(set);
+        pthread_mutex_unlock(&query->refresh_lock);
+        return false;
+    }
+
+    bool changed = set->len != old->len;
+    for (size_t i = 0; !changed && i < set->len; ++i)
+        changed = set->list[i] != old->list[i];
+
+    if (!changed) {
+        query_release(set);
+        pthread_mutex_unlock(&query->refresh_lock);
+        return true;
+    }
+
+    if (query->cache) query_refresh_cache(query->cache, old, set);
+    query_publish(query, set);
+
+    pthread_mutex_unlock(&query->refresh_lock);
+    return true;
+}
+
+bool rill_query_threads(struct rill_query *query, size_t threads)
+{
+    if (query->snapshot) {
+        rill_fail("unable to change the threads of a snapshot of '%s'", query->dir);
+        return false;
+    }
+
+    if (query->pool) {
+        pool_close(query->pool);
+        query->pool = NULL;
+    }
+
+    if (threads <= 1) return true;
+
+    query->pool = pool_open(threads);
+    return query->pool;
+}
+
+bool rill_query_cache(struct rill_query *query, size_t bytes)
+{
+    if (query->snapshot) {
+        rill_fail("unable to cache a snapshot of '%s'", query->dir);
+        return false;
+    }
+
+    if (query->cache) {
+        cache_close(query->cache);
+        query->cache = NULL;
+    }
+
+    if (!bytes) return true;
+
+    query->cache = cache_open(bytes, query->set->gen);
+    return query->cache;
+}
+
+bool rill_query_resident(struct rill_query *query, size_t bytes)
+{
+    if (query->snapshot) {
+        rill_fail("unable to make a snapshot of '%s' resident", query->dir);
+        return false;
+    }
+
+    query->resident = bytes;
+    return query_set_resident(query->set, NULL, bytes);
+}
+
+size_t rill_query_resident_bytes(const struct rill_query *query)
+{
+    struct query_set *set = query_acquire(query);
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < set->len; ++i)
+        bytes += rill_store_resident_bytes(set->list[i]);
+
+    query_release(set);
+    return bytes;
+}
+
+void rill_query_cache_stats(
+        const struct rill_query *query, struct rill_query_cache_stats *out)
+{
+    if (query->cache) cache_stats(query->cache, out);
+    else *out = (struct rill_query_cache_stats) {0};
+}
+
+void rill_query_open_stats(
+        const struct rill_query *query, struct rill_open_stats *out)
+{
+    pthread_mutex_t *lock = (pthread_mutex_t *) &query->refresh_lock;
+
+    pthread_mutex_lock(lock);
+    *out = query->open_stats;
+    pthread_mutex_unlock(lock);
+}
+
+
+// -----------------------------------------------------------------------------
+// fan-out
+// -----------------------------------------------------------------------------
+
+// Keys are handed out to workers in chunks of this size so that a large batch
+// over a handful of stores still keeps every worker busy.
+enum { query_chunk_keys = 1 << 14 };
+
+struct query_job
+{
+    const struct query_set *set;
+    enum rill_col col;
+
+    const rill_val_t *keys;
+    size_t len;
+    size_t chunks;
+
+    struct rill_rows *out; // one per worker
+};
+
+static bool query_store_keys(
+        const struct rill_store *store,
         enum rill_col col,
         const rill_val_t *keys, size_t len,
         struct rill_rows *out)
 {
-    if (!len) return true;
+    if (len == 1) return rill_store_query(store, col, keys[0], out);
+    return rill_store_query_keys(store, col, keys, len, out);
+}
+
+static bool query_job_run(void *ctx, size_t worker, size_t task)
+{
+    struct query_job *job = ctx;
+
+    size_t store = task / job->chunks;
+    size_t start = (task % job->chunks) * query_chunk_keys;
+    size_t len = job->len - start < query_chunk_keys ?
+        job->len - start : query_chunk_keys;
 
-    for (size_t i = 0; i < query->len; ++i) {
-        for (size_t j = 0; i < len; ++j) {
-            if (!rill_store_query(query->list[i], col, keys[j], out))
+    return query_store_keys(
+            job->set->list[store], job->col,
+            job->keys + start, len,
+            &job->out[worker]);
+}
+
+// Stores are immutable so they can be queried concurrently without any
+// coordination. Each worker accumulates its results in its own buffer which
+// are all merged into out at the end. Keys must be sorted.
+static bool query_fan_out(
+        const struct rill_query *query,
+        const struct query_set *set,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_rows *out)
+{
+    if (!query->pool) {
+        for (size_t i = 0; i < set->len; ++i) {
+            if (!query_store_keys(set->list[i], col, keys, len, out))
                 return false;
         }
+        return true;
+    }
+
+    size_t threads = pool_threads(query->pool);
+    struct rill_rows results[threads];
+    memset(results, 0, sizeof(results));
+
+    struct query_job job = {
+        .set = set,
+        .col = col,
+        .keys = keys,
+        .len = len,
+        .chunks = (len + query_chunk_keys - 1) / query_chunk_keys,
+        .out = results,
+    };
+
+    bool ok = pool_run(query->pool, set->len * job.chunks, query_job_run, &job);
+
+    for (size_t i = 0; i < threads; ++i) {
+        if (ok) ok = rill_rows_append(out, &results[i]);
+        rill_rows_free(&results[i]);
+    }
+
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// it
+// -----------------------------------------------------------------------------
+
+struct query_it_src
+{
+    struct rill_row row;
+    struct rill_store_it *it;
+};
+
+// Min-heap of the stores that contain the keys ordered by their current row.
+struct rill_query_it
+{
+    struct query_set *set; // released with the iterator if set.
+    struct rill_row prev;
+
+    size_t len;
+    struct query_it_src heap[];
+};
+
+static void query_it_sift(struct rill_query_it *it, size_t i)
+{
+    struct query_it_src *heap = it->heap;
+
+    while (true) {
+        size_t min = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < it->len && rill_row_cmp(&heap[left].row, &heap[min].row) < 0)
+            min = left;
+        if (right < it->len && rill_row_cmp(&heap[right].row, &heap[min].row) < 0)
+            min = right;
+        if (min == i) return;
+
+        struct query_it_src tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+// Merges the rows of the keys in [from, to) across the stores in list.
+static struct rill_query_it *query_it_open(
+        struct rill_store *const *list, size_t len,
+        enum rill_col col, rill_val_t from, rill_val_t to)
+{
+    struct rill_query_it *it = calloc(1, sizeof(*it) + len * sizeof(it->heap[0]));
+    if (!it) {
+        rill_fail("unable to allocate query iterator: %lu", len);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        struct query_it_src *src = &it->heap[it->len];
+
+        src->it = rill_store_begin_range(list[i], col, from, to);
+        if (!src->it) goto fail;
+
+        if (!rill_store_it_next(src->it, &src->row)) {
+            rill_store_it_free(src->it);
+            goto fail;
+        }
+
+        if (rill_row_nil(&src->row)) rill_store_it_free(src->it);
+        else it->len++;
+    }
+
+    for (size_t i = it->len; i > 0; --i) query_it_sift(it, i - 1);
+    return it;
+
+  fail:
+    rill_query_it_free(it);
+    return NULL;
+}
+
+struct rill_query_it *rill_query_begin(
+        const struct rill_query *query, enum rill_col col, rill_val_t key)
+{
+    struct query_set *set = query_acquire(query);
+
+    struct rill_query_it *it = key ?
+        query_it_open(set->list, set->len, col, key, key + 1) :
+        query_it_open(set->list, 0, col, 0, 0);
+
+    if (it) it->set = set;
+    else query_release(set);
+    return it;
+}
+
+void rill_query_it_free(struct rill_query_it *it)
+{
+    for (size_t i = 0; i < it->len; ++i)
+        rill_store_it_free(it->heap[i].it);
+    if (it->set) query_release(it->set);
+    free(it);
+}
+
+bool rill_query_it_next(struct rill_query_it *it, struct rill_row *out)
+{
+    while (it->len) {
+        struct query_it_src *top = &it->heap[0];
+        *out = top->row;
+
+        if (!rill_store_it_next(top->it, &top->row)) return false;
+        if (rill_row_nil(&top->row)) {
+            rill_store_it_free(top->it);
+            it->heap[0] = it->heap[--it->len];
+        }
+        query_it_sift(it, 0);
+
+        if (rill_row_nil(&it->prev) || rill_row_cmp(&it->prev, out) < 0) {
+            it->prev = *out;
+            return true;
+        }
     }
 
+    *out = (struct rill_row) {0};
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// query
+// -----------------------------------------------------------------------------
+
+// Goes through rill_store_query which checks the filter and index of each store
+// before allocating anything. The merged iterator is left to rill_query_begin.
+static bool query_key(
+        const struct rill_query *query,
+        const struct query_set *set,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_rows *out)
+{
+    if (!query_fan_out(query, set, col, &key, 1, out)) return false;
     rill_rows_compact(out);
     return true;
 }
+
+static bool query_key_cached(
+        const struct rill_query *query,
+        const struct query_set *set,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_rows *out)
+{
+    if (!query->cache) return query_key(query, set, col, key, out);
+
+    bool compact = out->len;
+    if (cache_get(query->cache, col, key, out)) {
+        if (compact) rill_rows_compact(out);
+        return true;
+    }
+
+    struct rill_rows rows = {0};
+    bool ok = query_key(query, set, col, key, &rows);
+    if (ok) {
+        cache_put(query->cache, set->gen, col, key, &rows);
+        ok = rill_rows_append(out, &rows);
+    }
+    rill_rows_free(&rows);
+
+    if (ok && compact) rill_rows_compact(out);
+    return ok;
+}
+
+bool rill_query_key(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_rows *out)
+{
+    if (!key) return false;
+
+    struct query_set *set = query_acquire(query);
+    bool ok = query_key_cached(query, set, col, key, out);
+    query_release(set);
+    return ok;
+}
+
+// Stores that hold data for the [from, to) time range. A store covers its quant
+// aligned window while stores without a quant, i.e. fresh acc flushes, can hold
+// rows of any time and are never pruned.
+static size_t query_range(
+        const struct query_set *set,
+        rill_ts_t from, rill_ts_t to,
+        struct rill_store **out)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < set->len; ++i) {
+        struct rill_store *store = set->list[i];
+        rill_ts_t ts = rill_store_ts(store);
+        rill_ts_t quant = rill_store_quant(store);
+
+        if (!quant) { out[len++] = store; continue; }
+
+        rill_ts_t start = ts - (ts % quant);
+        if (start < to && start + quant > from) out[len++] = store;
+    }
+
+    return len;
+}
+
+// Goes through the same fan out as rill_query_key over the stores in range.
+// The cache holds the rows of a key across every store so it's only used when
+// none of them were pruned.
+bool rill_query_key_range(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        rill_ts_t from, rill_ts_t to,
+        struct rill_rows *out)
+{
+    if (!key) return false;
+
+    struct query_set *set = query_acquire(query);
+
+    struct rill_store **list = calloc(set->len + 1, sizeof(*list));
+    if (!list) {
+        rill_fail("unable to allocate store list: %lu", set->len);
+        query_release(set);
+        return false;
+    }
+
+    struct query_set range = { .gen = set->gen, .list = list };
+    range.len = query_range(set, from, to, list);
+
+    bool ok = range.len == set->len ?
+        query_key_cached(query, set, col, key, out) :
+        query_key(query, &range, col, key, out);
+
+    free(list);
+    query_release(set);
+    return ok;
+}
+
+static int key_cmp(const void *l, const void *r)
+{
+    rill_val_t lhs = *((const rill_val_t *) l);
+    rill_val_t rhs = *((const rill_val_t *) r);
+
+    if (lhs < rhs) return -1;
+    if (lhs > rhs) return 1;
+    return 0;
+}
+
+// Sorts and dedups the keys once so that every store can be merge-joined
+// against them. Nil keys are dropped along the way.
+static size_t sort_keys(const rill_val_t *keys, size_t len, rill_val_t *out)
+{
+    memcpy(out, keys, len * sizeof(keys[0]));
+    qsort(out, len, sizeof(out[0]), key_cmp);
+
+    size_t j = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (!out[i] || (j && out[j - 1] == out[i])) continue;
+        out[j++] = out[i];
+    }
+
+    return j;
+}
+
+bool rill_query_keys(
+        const struct rill_query *query,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_rows *out)
+{
+    if (!len) return true;
+
+    rill_val_t *sorted = calloc(len, sizeof(*sorted));
+    if (!sorted) {
+        rill_fail("unable to allocate memory for keys: %lu", len);
+        return false;
+    }
+
+    len = sort_keys(keys, len, sorted);
+
+    struct query_set *set = query_acquire(query);
+    bool ok = !len || query_fan_out(query, set, col, sorted, len, out);
+    query_release(set);
+    free(sorted);
+
+    if (ok) rill_rows_compact(out);
+    return ok;
+}
+
+bool rill_query_contains(
+        const struct rill_query *query, rill_val_t a, rill_val_t b, bool *out)
+{
+    *out = false;
+    if (!a || !b) return true;
+
+    bool ok = true;
+    struct query_set *set = query_acquire(query);
+
+    for (size_t i = 0; ok && !*out && i < set->len; ++i)
+        ok = rill_store_contains(set->list[i], a, b, out);
+
+    query_release(set);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// count
+// -----------------------------------------------------------------------------
+
+// A key that only lives in a single store can be counted straight from its list
+// while keys spread over multiple stores have to be merged to weed out the
+// duplicates. Rows are never materialized in either case.
+static bool query_count_key(
+        const struct query_set *set,
+        enum rill_col col,
+        rill_val_t key,
+        size_t *out)
+{
+    size_t len = 0, count = 0;
+    struct rill_store *list[set->len + 1];
+
+    for (size_t i = 0; i < set->len; ++i) {
+        size_t n = 0;
+        if (!rill_store_count(set->list[i], col, key, &n)) return false;
+        if (!n) continue;
+
+        list[len++] = set->list[i];
+        count = n;
+    }
+
+    if (len <= 1) {
+        *out += count;
+        return true;
+    }
+
+    struct rill_query_it *it = query_it_open(list, len, col, key, key + 1);
+    if (!it) return false;
+
+    struct rill_row row = {0};
+    while (true) {
+        if (!rill_query_it_next(it, &row)) goto fail;
+        if (rill_row_nil(&row)) break;
+        (*out)++;
+    }
+
+    rill_query_it_free(it);
+    return true;
+
+  fail:
+    rill_query_it_free(it);
+    return false;
+}
+
+bool rill_query_count(
+        const struct rill_query *query,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        size_t *out)
+{
+    *out = 0;
+    if (!len) return true;
+
+    rill_val_t *sorted = calloc(len, sizeof(*sorted));
+    if (!sorted) {
+        rill_fail("unable to allocate memory for keys: %lu", len);
+        return false;
+    }
+
+    len = sort_keys(keys, len, sorted);
+    struct query_set *set = query_acquire(query);
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < len; ++i)
+        ok = query_count_key(set, col, sorted[i], out);
+
+    query_release(set);
+    free(sorted);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// top
+// -----------------------------------------------------------------------------
+
+static int key_count_cmp(const void *l, const void *r)
+{
+    const struct rill_key_count *lhs = l, *rhs = r;
+    if (lhs->count > rhs->count) return -1;
+    if (lhs->count < rhs->count) return +1;
+    if (lhs->key < rhs->key) return -1;
+    if (lhs->key > rhs->key) return +1;
+    return 0;
+}
+
+bool rill_query_top_keys(
+        const struct rill_query *query,
+        enum rill_col col,
+        size_t k,
+        struct rill_key_count *out,
+        size_t *len)
+{
+    *len = 0;
+    if (!k) return true;
+
+    bool ok = false;
+    struct rill_vals candidates = {0};
+    struct rill_key_count *ranked = NULL;
+    struct query_set *set = query_acquire(query);
+
+    struct rill_key_count *top = calloc(k, sizeof(*top));
+    if (!top) {
+        rill_fail("unable to allocate top keys: %lu", k);
+        goto done;
+    }
+
+    for (size_t i = 0; i < set->len; ++i) {
+        size_t n = 0;
+        if (!rill_store_top_keys(set->list[i], col, k, top, &n)) goto done;
+
+        for (size_t j = 0; j < n; ++j) {
+            if (!rill_vals_push(&candidates, top[j].key)) goto done;
+        }
+    }
+    rill_vals_compact(&candidates);
+
+    ranked = calloc(candidates.len + 1, sizeof(*ranked));
+    if (!ranked) {
+        rill_fail("unable to allocate candidates: %lu", candidates.len);
+        goto done;
+    }
+
+    for (size_t i = 0; i < candidates.len; ++i) {
+        ranked[i].key = candidates.data[i];
+        if (!query_count_key(set, col, ranked[i].key, &ranked[i].count))
+            goto done;
+    }
+
+    qsort(ranked, candidates.len, sizeof(ranked[0]), key_count_cmp);
+
+    *len = candidates.len < k ? candidates.len : k;
+    memcpy(out, ranked, *len * sizeof(ranked[0]));
+    ok = true;
+
+  done:
+    query_release(set);
+    free(top);
+    free(ranked);
+    rill_vals_free(&candidates);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+// Values of a given key can be spread over multiple stores so the ordinal
+// domain only works within a store. Across stores, the lists of each keys are
+// first gathered in the value domain which is where the set operation is
+// carried out.
+static bool query_set_gather(
+        const struct query_set *set,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
+{
+    for (size_t i = 0; i < set->len; ++i) {
+        if (!rill_store_set(set->list[i], col, rill_set_union, keys, len, out))
+            return false;
+    }
+
+    rill_vals_compact(out);
+    return true;
+}
+
+static int query_vals_cmp(const void *l, const void *r)
+{
+    const struct rill_vals *lhs = l, *rhs = r;
+    if (lhs->len < rhs->len) return -1;
+    if (lhs->len > rhs->len) return +1;
+    return 0;
+}
+
+static bool query_set(
+        const struct query_set *set,
+        enum rill_col col,
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
+{
+    if (!set->len) return true;
+    if (set->len == 1)
+        return rill_store_set(set->list[0], col, op, keys, len, out);
+
+    // The extra list gives an empty key set something to gather into.
+    bool ok = false;
+    struct rill_vals *lists = calloc(len + 1, sizeof(*lists));
+    if (!lists) {
+        rill_fail("unable to allocate set lists: %lu", len);
+        return false;
+    }
+
+    switch (op) {
+
+    case rill_set_union:
+        if (!query_set_gather(set, col, keys, len, &lists[0])) goto done;
+        break;
+
+    case rill_set_intersect:
+        for (size_t i = 0; i < len; ++i) {
+            if (!query_set_gather(set, col, &keys[i], 1, &lists[i])) goto done;
+        }
+
+        qsort(lists, len, sizeof(lists[0]), query_vals_cmp);
+        for (size_t i = 1; lists[0].len && i < len; ++i) {
+            lists[0].len = set_intersect(
+                    lists[0].data, lists[0].len,
+                    lists[i].data, lists[i].len,
+                    lists[0].data);
+        }
+        break;
+
+    case rill_set_diff:
+        // The other keys can be lumped together as the result is the same.
+        if (!query_set_gather(set, col, keys, 1, &lists[0])) goto done;
+        if (len > 1 && lists[0].len) {
+            if (!query_set_gather(set, col, keys + 1, len - 1, &lists[1]))
+                goto done;
+
+            lists[0].len = set_diff(
+                    lists[0].data, lists[0].len,
+                    lists[1].data, lists[1].len,
+                    lists[0].data);
+        }
+        break;
+
+    default:
+        rill_fail("unknown set operation: %d", op);
+        goto done;
+    }
+
+    if (!rill_vals_reserve(out, out->len + lists[0].len)) goto done;
+    memcpy(out->data + out->len, lists[0].data, lists[0].len * sizeof(lists[0].data[0]));
+    out->len += lists[0].len;
+    ok = true;
+
+  done:
+    for (size_t i = 0; i <= len; ++i) rill_vals_free(&lists[i]);
+    free(lists);
+    return ok;
+}
+
+bool rill_query_set(
+        const struct rill_query *query,
+        enum rill_col col,
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
+{
+    if (!len) return true;
+
+    struct query_set *set = query_acquire(query);
+    bool ok = query_set(set, col, op, keys, len, out);
+    query_release(set);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// expand
+// -----------------------------------------------------------------------------
+
+bool rill_query_expand(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_vals *out)
+{
+    if (!key) return true;
+
+    bool ok = false;
+    struct rill_vals frontier = {0}, result = {0};
+    struct query_set *set = query_acquire(query);
+
+    // The first hop is sorted and deduped across all stores so that every
+    // store can be merge-joined against the same frontier.
+    if (!query_set_gather(set, col, &key, 1, &frontier)) goto done;
+
+    for (size_t i = 0; i < set->len; ++i) {
+        if (!rill_store_expand(set->list[i], rill_col_flip(col),
+                        frontier.data, frontier.len, &result))
+            goto done;
+    }
+    rill_vals_compact(&result);
+
+    if (!rill_vals_reserve(out, out->len + result.len)) goto done;
+    memcpy(out->data + out->len, result.data, result.len * sizeof(result.data[0]));
+    out->len += result.len;
+    ok = true;
+
+  done:
+    query_release(set);
+    rill_vals_free(&frontier);
+    rill_vals_free(&result);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// similar
+// -----------------------------------------------------------------------------
+
+static bool query_minhash(
+        const struct query_set *set, rill_val_t key, struct rill_minhash *out)
+{
+    rill_minhash_reset(out);
+
+    for (size_t i = 0; i < set->len; ++i) {
+        if (!rill_store_minhash(set->list[i], key, out)) return false;
+    }
+
+    return true;
+}
+
+static int similar_cmp(const void *l, const void *r)
+{
+    const struct rill_similar *lhs = l, *rhs = r;
+    if (lhs->similarity > rhs->similarity) return -1;
+    if (lhs->similarity < rhs->similarity) return +1;
+    if (lhs->key < rhs->key) return -1;
+    if (lhs->key > rhs->key) return +1;
+    return 0;
+}
+
+bool rill_query_similar(
+        const struct rill_query *query,
+        rill_val_t key,
+        size_t k,
+        struct rill_similar *out,
+        size_t *len)
+{
+    *len = 0;
+    if (!key || !k) return true;
+
+    bool ok = false;
+    struct rill_vals candidates = {0};
+    struct rill_similar *ranked = NULL;
+    struct query_set *set = query_acquire(query);
+
+    struct rill_minhash sig = {0};
+    if (!query_minhash(set, key, &sig)) goto done;
+
+    for (size_t i = 0; i < set->len; ++i) {
+        if (!rill_store_similar(set->list[i], key, &candidates)) goto done;
+    }
+    rill_vals_compact(&candidates);
+
+    ranked = calloc(candidates.len + 1, sizeof(*ranked));
+    if (!ranked) {
+        rill_fail("unable to allocate candidates: %lu", candidates.len);
+        goto done;
+    }
+
+    size_t n = 0;
+    struct rill_minhash other = {0};
+    for (size_t i = 0; i < candidates.len; ++i) {
+        if (candidates.data[i] == key) continue;
+        if (!query_minhash(set, candidates.data[i], &other)) goto done;
+
+        ranked[n++] = (struct rill_similar) {
+            .key = candidates.data[i],
+            .similarity = rill_minhash_jaccard(&sig, &other),
+        };
+    }
+
+    qsort(ranked, n, sizeof(ranked[0]), similar_cmp);
+
+    *len = n < k ? n : k;
+    memcpy(out, ranked, *len * sizeof(ranked[0]));
+    ok = true;
+
+  done:
+    query_release(set);
+    free(ranked);
+    rill_vals_free(&candidates);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// scan
+// -----------------------------------------------------------------------------
+
+// Number of ranges handed out to each thread which evens out the load when the
+// keys of the biggest store aren't representative of the others.
+enum { query_scan_ranges = 4 };
+
+struct query_scan
+{
+    struct query_set *set;
+    enum rill_col col;
+
+    rill_scan_fn_t fn;
+    void *ctx;
+    bool aborted;
+
+    // range i covers the keys in [bounds[i], bounds[i + 1]).
+    size_t ranges;
+    rill_val_t *bounds;
+};
+
+static bool query_scan_range(void *ctx, size_t worker, size_t range)
+{
+    (void) worker;
+    struct query_scan *scan = ctx;
+
+    struct rill_query_it *it = query_it_open(
+            scan->set->list, scan->set->len, scan->col,
+            scan->bounds[range], scan->bounds[range + 1]);
+    if (!it) return false;
+
+    bool ok = true;
+    rill_val_t key = 0;
+    size_t len = 0, cap = 0;
+    rill_val_t *vals = NULL;
+
+    struct rill_row row = {0};
+    while (ok) {
+        if (!rill_query_it_next(it, &row)) { ok = false; break; }
+
+        if (row.a != key) {
+            if (len) ok = scan->fn(scan->ctx, key, vals, len);
+            if (!ok || __atomic_load_n(&scan->aborted, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&scan->aborted, true, __ATOMIC_RELAXED);
+                break;
+            }
+
+            key = row.a;
+            len = 0;
+        }
+
+        if (rill_row_nil(&row)) break;
+
+        if (len == cap) {
+            cap = cap ? cap * 2 : 64;
+            rill_val_t *next = realloc(vals, cap * sizeof(*vals));
+            if (!next) {
+                rill_fail("unable to allocate scan values: %lu", cap);
+                ok = false;
+                break;
+            }
+            vals = next;
+        }
+        vals[len++] = row.b;
+    }
+
+    free(vals);
+    rill_query_it_free(it);
+    return ok;
+}
+
+// Ranges are split on the quantiles of the keys of the biggest store.
+static bool query_scan_bounds(struct query_scan *scan, size_t threads)
+{
+    size_t keys = 0;
+    const struct rill_store *biggest = NULL;
+    for (size_t i = 0; i < scan->set->len; ++i) {
+        const struct rill_store *store = scan->set->list[i];
+
+        size_t len = 0;
+        if (!rill_store_vals_count(store, scan->col, &len)) return false;
+        if (biggest && len <= keys) continue;
+
+        biggest = store;
+        keys = len;
+    }
+
+    scan->ranges = threads * query_scan_ranges;
+    if (scan->ranges > keys) scan->ranges = keys ? keys : 1;
+
+    scan->bounds = calloc(scan->ranges + 1, sizeof(*scan->bounds));
+    if (!scan->bounds) {
+        rill_fail("unable to allocate scan ranges: %lu", scan->ranges);
+        return false;
+    }
+
+    // first and last bounds are left at 0 to cover the whole key space.
+    for (size_t i = 1; i < scan->ranges; ++i) {
+        size_t key = i * keys / scan->ranges;
+        if (!rill_store_val_at(biggest, scan->col, key, &scan->bounds[i])) return false;
+    }
+
+    return true;
+}
+
+bool rill_query_scan(
+        const struct rill_query *query,
+        enum rill_col col,
+        size_t threads,
+        rill_scan_fn_t fn, void *ctx)
+{
+    if (!threads) threads = 1;
+
+    struct query_scan scan = {
+        .set = query_acquire(query),
+        .col = col,
+        .fn = fn,
+        .ctx = ctx,
+    };
+
+    bool ok = true;
+    struct pool *pool = NULL;
+
+    if (!scan.set->len) goto done;
+    if (!query_scan_bounds(&scan, threads)) { ok = false; goto done; }
+
+    if (threads > 1) {
+        if (!(pool = pool_open(threads))) { ok = false; goto done; }
+        ok = pool_run(pool, scan.ranges, query_scan_range, &scan);
+        pool_close(pool);
+    }
+    else {
+        for (size_t i = 0; ok && i < scan.ranges; ++i)
+            ok = query_scan_range(&scan, 0, i);
+    }
+
+  done:
+    query_release(scan.set);
+    free(scan.bounds);
+    return ok && !scan.aborted;
+}
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+bool rill_query_sketch(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_sketch *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    bool ok = true;
+    struct query_set *set = query_acquire(query);
+
+    for (size_t i = 0; ok && i < set->len; ++i)
+        ok = rill_store_sketch(set->list[i], col, key, out);
+
+    query_release(set);
+    return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+// Lookups are run on the pool of the query from a driver thread so that the
+// caller can reap keys as they complete. Completed keys are queued in the order
+// in which they finished. Cancelling skips the lookups that haven't started
+// yet but waits on the ones in flight.
+struct rill_query_batch
+{
+    const struct rill_query *query;
+    struct query_set *set;
+    enum rill_col col;
+
+    size_t len;
+    const rill_val_t *keys;
+
+    pthread_t driver;
+    size_t round; // first key of the round running on the pool.
+
+    struct rill_rows *rows; // indexed by key
+    size_t *order; // keys in the order they completed
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    size_t completed, reaped;
+    bool finished, cancelled, failed;
+    struct rill_error error;
+};
+
+// Can't go through query_key as the pool of the query can't be nested in
+// itself.
+static bool query_batch_key(
+        const struct rill_query_batch *batch, rill_val_t key, struct rill_rows *out)
+{
+    const struct rill_query *query = batch->query;
+    if (!key) return true;
+    if (query->cache && cache_get(query->cache, batch->col, key, out)) return true;
+
+    for (size_t i = 0; i < batch->set->len; ++i)
+        if (!rill_store_query(batch->set->list[i], batch->col, key, out)) return false;
+    rill_rows_compact(out);
+
+    if (query->cache) cache_put(query->cache, batch->set->gen, batch->col, key, out);
+    return true;
+}
+
+static bool query_batch_task(void *ctx, size_t worker, size_t task)
+{
+    (void) worker;
+    struct rill_query_batch *batch = ctx;
+    if (__atomic_load_n(&batch->cancelled, __ATOMIC_RELAXED)) return true;
+
+    bool ok = query_batch_key(batch, batch->keys[task], &batch->rows[task]);
+
+    pthread_mutex_lock(&batch->lock);
+
+    if (ok) batch->order[batch->completed++] = task;
+    else if (!batch->failed) {
+        batch->failed = true;
+        batch->error = rill_errno;
+        __atomic_store_n(&batch->cancelled, true, __ATOMIC_RELAXED);
+    }
+
+    pthread_cond_signal(&batch->wake);
+    pthread_mutex_unlock(&batch->lock);
+    return ok;
+}
+
+// Keys are fed to the pool in rounds so that other queries sharing it get a
+// turn in between.
+enum { query_batch_round = 1024 };
+
+static bool query_batch_round_task(void *ctx, size_t worker, size_t task)
+{
+    struct rill_query_batch *batch = ctx;
+    return query_batch_task(batch, worker, batch->round + task);
+}
+
+static void *query_batch_drive(void *ctx)
+{
+    struct rill_query_batch *batch = ctx;
+    struct pool *pool = batch->query->pool;
+
+    for (size_t i = 0; i < batch->len; i += query_batch_round) {
+        if (__atomic_load_n(&batch->cancelled, __ATOMIC_RELAXED)) break;
+
+        size_t len = batch->len - i < query_batch_round ?
+            batch->len - i : query_batch_round;
+
+        if (!pool) {
+            for (size_t j = 0; j < len; ++j) (void) query_batch_task(batch, 0, i + j);
+            continue;
+        }
+
+        batch->round = i;
+        (void) pool_run(pool, len, query_batch_round_task, batch);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->finished = true;
+    pthread_cond_signal(&batch->wake);
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+struct rill_query_batch *rill_query_batch(
+        const struct rill_query *query,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len)
+{
+    struct rill_query_batch *batch = calloc(1, sizeof(*batch));
+    if (!batch) {
+        rill_fail("unable to allocate batch");
+        goto fail_alloc;
+    }
+
+    batch->query = query;
+    batch->col = col;
+    batch->keys = keys;
+    batch->len = len;
+
+    batch->rows = calloc(len ? len : 1, sizeof(*batch->rows));
+    batch->order = calloc(len ? len : 1, sizeof(*batch->order));
+    if (!batch->rows || !batch->order) {
+        rill_fail("unable to allocate batch of '%zu' keys", len);
+        goto fail_list;
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->wake, NULL);
+    batch->set = query_acquire(query);
+
+    int err = pthread_create(&batch->driver, NULL, query_batch_drive, batch);
+    if (err) {
+        errno = err;
+        rill_fail_errno("unable to spawn batch thread");
+        goto fail_thread;
+    }
+
+    return batch;
+
+  fail_thread:
+    query_release(batch->set);
+    pthread_cond_destroy(&batch->wake);
+    pthread_mutex_destroy(&batch->lock);
+  fail_list:
+    free(batch->order);
+    free(batch->rows);
+    free(batch);
+  fail_alloc:
+    return NULL;
+}
+
+bool rill_query_batch_next(
+        struct rill_query_batch *batch, size_t *key, struct rill_rows *out)
+{
+    pthread_mutex_lock(&batch->lock);
+
+    while (batch->reaped == batch->completed && !batch->finished)
+        pthread_cond_wait(&batch->wake, &batch->lock);
+
+    if (batch->reaped == batch->completed) {
+        bool failed = batch->failed;
+        if (failed) rill_errno = batch->error;
+        pthread_mutex_unlock(&batch->lock);
+
+        *key = batch->len;
+        return !failed;
+    }
+
+    size_t task = batch->order[batch->reaped++];
+    pthread_mutex_unlock(&batch->lock);
+
+    *key = task;
+    bool ok = rill_rows_append(out, &batch->rows[task]);
+    rill_rows_free(&batch->rows[task]);
+    batch->rows[task] = (struct rill_rows) {0};
+    return ok;
+}
+
+void rill_query_batch_free(struct rill_query_batch *batch)
+{
+    __atomic_store_n(&batch->cancelled, true, __ATOMIC_RELAXED);
+    pthread_join(batch->driver, NULL);
+    query_release(batch->set);
+
+    for (size_t i = 0; i < batch->len; ++i)
+        rill_rows_free(&batch->rows[i]);
+    free(batch->rows);
+    free(batch->order);
+
+    pthread_cond_destroy(&batch->wake);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+}
@@ -108,6 +108,78 @@ bool rill_rows_copy(const struct rill_rows *, struct rill_rows *out);
 void rill_rows_print(const struct rill_rows *);
 
 
+// -----------------------------------------------------------------------------
+// vals
+// -----------------------------------------------------------------------------
+
+struct rill_vals
+{
+    size_t len, cap;
+    rill_val_t *data;
+};
+
+void rill_vals_free(struct rill_vals *);
+void rill_vals_clear(struct rill_vals *);
+
+bool rill_vals_push(struct rill_vals *, rill_val_t val);
+bool rill_vals_reserve(struct rill_vals *, size_t cap);
+
+// Sorts and removes duplicates.
+void rill_vals_compact(struct rill_vals *);
+
+
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+// Operations over the value lists of multiple keys. Diff yields the values of
+// the first key that aren't in the lists of any of the other keys.
+enum rill_set_op
+{
+    rill_set_union = 0,
+    rill_set_intersect = 1,
+    rill_set_diff = 2,
+};
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+// HyperLogLog sketch of a set of values. Sketches are unioned by taking the
+// max of each register which is how rill_store_sketch accumulates into out.
+
+enum { rill_sketch_regs = 1 << 10 };
+
+struct rill_sketch
+{
+    uint8_t regs[rill_sketch_regs];
+};
+
+double rill_sketch_estimate(const struct rill_sketch *);
+
+
+// -----------------------------------------------------------------------------
+// minhash
+// -----------------------------------------------------------------------------
+
+// MinHash signature of a set of values. Signatures are unioned by taking the
+// min of each hash which is how rill_store_minhash accumulates into out.
+
+enum { rill_minhash_len = 32 };
+
+struct rill_minhash
+{
+    uint32_t mins[rill_minhash_len];
+};
+
+// Must be called before accumulating into a signature.
+void rill_minhash_reset(struct rill_minhash *);
+
+// Estimate of the Jaccard similarity between the two sets.
+double rill_minhash_jaccard(const struct rill_minhash *, const struct rill_minhash *);
+
+
 // -----------------------------------------------------------------------------
 // store
 // -----------------------------------------------------------------------------
@@ -118,6 +190,57 @@ struct rill_store_it;
 struct rill_store *rill_store_open(const char *file);
 void rill_store_close(struct rill_store *store);
 
+enum rill_store_flags
+{
+    // Only reads the header and filters on open and defers mapping the store
+    // until it's first queried. Mapped lazy stores are unmapped, least
+    // recently used first, once there's more of them then the map cap.
+    // Their file stays open until they're closed so they can still be mapped
+    // once it's removed.
+    rill_store_lazy = 1 << 0,
+
+    // Access modes which are mutually exclusive and tune the kernel readahead
+    // of the rows of the store. random suits point queries and sequential
+    // suits iterating over whole columns. scan_once is for stores that are
+    // read through once, such as merge inputs. It also drops the rows from
+    // the page cache once an iterator or merge has moved past them.
+    rill_store_random = 1 << 1,
+    rill_store_sequential = 1 << 2,
+    rill_store_scan_once = 1 << 3,
+
+    // Reads the index, mph and filter sections in memory on open and serves
+    // rill_store_query, rill_store_query_keys and rill_store_count by reading
+    // the lists they need with pread instead of going through the mapping.
+    // Other operations map the store as if it was opened with rill_store_lazy.
+    rill_store_pread = 1 << 4,
+};
+
+struct rill_store *rill_store_open_flags(const char *file, unsigned flags);
+
+// Time spent in each phase of opening stores. Phases are summed over every
+// store and thread and can therefore add up to more than wall_ns. For lazy
+// stores, map_ns is the time spent reading the header and filters.
+struct rill_open_stats
+{
+    size_t stores;
+    uint64_t list_ns;
+    uint64_t stat_ns, open_ns, map_ns, check_ns;
+    uint64_t wall_ns;
+};
+
+// Same as rill_store_open_flags but adds the time spent opening the store to
+// stats.
+struct rill_store *rill_store_open_stats(
+        const char *file, unsigned flags, struct rill_open_stats *stats);
+
+// Process-wide cap on the number of lazy stores mapped at once. Stores in use
+// are never unmapped so the cap can be temporarily exceeded.
+void rill_store_map_cap(size_t cap);
+
+// Handles are refcounted: every ref must be matched by a rill_store_close and
+// the store is only unmapped once the last one goes away.
+struct rill_store *rill_store_ref(struct rill_store *store);
+
 bool rill_store_write(
         const char *file,
         rill_ts_t ts,
@@ -137,25 +260,105 @@ rill_ts_t rill_store_ts(const struct rill_store *);
 size_t rill_store_quant(const struct rill_store *);
 size_t rill_store_rows(const struct rill_store *);
 
-size_t rill_store_vals(
-        const struct rill_store *, enum rill_col, rill_val_t *out, size_t len);
-size_t rill_store_vals_count(const struct rill_store *, enum rill_col);
+// Lazy stores are mapped on demand so every accessor that reads from the
+// mapping can fail.
+bool rill_store_vals(
+        const struct rill_store *, enum rill_col,
+        rill_val_t *out, size_t cap, size_t *len);
+bool rill_store_vals_count(const struct rill_store *, enum rill_col, size_t *out);
+bool rill_store_val_at(
+        const struct rill_store *, enum rill_col, size_t i, rill_val_t *out);
 
 bool rill_store_query(
         const struct rill_store *, enum rill_col, rill_val_t, struct rill_rows *out);
+bool rill_store_query_keys(
+        const struct rill_store *,
+        enum rill_col,
+        const rill_val_t *sorted_keys, size_t len,
+        struct rill_rows *out);
+bool rill_store_contains(
+        const struct rill_store *, rill_val_t a, rill_val_t b, bool *out);
+bool rill_store_count(
+        const struct rill_store *, enum rill_col, rill_val_t key, size_t *out);
+struct rill_key_count
+{
+    rill_val_t key;
+    size_t count;
+};
+
+// Fills out with up to k keys with the most values sorted by decreasing count.
+bool rill_store_top_keys(
+        const struct rill_store *,
+        enum rill_col,
+        size_t k,
+        struct rill_key_count *out,
+        size_t *len);
+
+// Appends the sorted result of the set operation to out.
+bool rill_store_set(
+        const struct rill_store *,
+        enum rill_col,
+        enum rill_set_op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out);
+// Appends the sorted and unique values of the lists of the sorted keys to out.
+bool rill_store_expand(
+        const struct rill_store *,
+        enum rill_col,
+        const rill_val_t *sorted_keys, size_t len,
+        struct rill_vals *out);
+// Only applies to column a. Month stores keep a signature for most of their
+// keys while the others compute it from the values of the key.
+bool rill_store_minhash(
+        const struct rill_store *, rill_val_t key, struct rill_minhash *out);
+
+// Appends the keys of column a whose signature shares a band with the one of
+// key. Only month stores have the index required to find candidates.
+bool rill_store_similar(const struct rill_store *, rill_val_t key, struct rill_vals *out);
+
+bool rill_store_sketch(
+        const struct rill_store *, enum rill_col, rill_val_t key, struct rill_sketch *out);
 
 struct rill_store_it *rill_store_begin(const struct rill_store *, enum rill_col);
+struct rill_store_it *rill_store_begin_key(
+        const struct rill_store *, enum rill_col, rill_val_t key);
+// Iterates over the rows of every key in [from, to). 0 for to iterates until
+// the end of the column.
+struct rill_store_it *rill_store_begin_range(
+        const struct rill_store *, enum rill_col, rill_val_t from, rill_val_t to);
 void rill_store_it_free(struct rill_store_it *);
 bool rill_store_it_next(struct rill_store_it *, struct rill_row *out);
 
+// Fills rows with up to cap rows and returns the number of rows in len. A len
+// of 0 indicates the end of the iterator.
+bool rill_store_it_next_batch(
+        struct rill_store_it *, struct rill_row *rows, size_t cap, size_t *len);
+
 struct rill_store_stats
 {
     size_t header_bytes;
     size_t index_bytes[2];
+    size_t mph_bytes[2];
+    size_t filter_bytes[2];
+    size_t hll_bytes[2];
+    size_t minhash_bytes;
     size_t rows_bytes[2];
+    size_t resident_bytes;
 };
 
-void rill_store_stats(const struct rill_store *, struct rill_store_stats *);
+bool rill_store_stats(const struct rill_store *, struct rill_store_stats *);
+
+// Copies the index, mph and filter sections of the store into anonymous memory
+// backed by transparent huge pages where they can't be evicted by merges or
+// other page cache traffic. The copy lives until the store is closed. Must
+// not be called while the store is being queried.
+bool rill_store_resident(struct rill_store *);
+
+// Bytes of the store held in its resident copy, 0 if it doesn't have one.
+size_t rill_store_resident_bytes(const struct rill_store *);
+
+// Bytes that rill_store_resident would copy.
+size_t rill_store_lookup_bytes(const struct rill_store *);
 
 
 // -----------------------------------------------------------------------------
@@ -187,8 +390,55 @@ bool rill_rotate(const char *dir, rill_ts_t now);
 struct rill_query;
 
 struct rill_query * rill_query_open(const char *dir);
+struct rill_query * rill_query_open_flags(const char *dir, unsigned flags);
+
+// Opens the stores over a pool of threads which is then kept for queries as
+// with rill_query_threads.
+struct rill_query * rill_query_open_threads(
+        const char *dir, unsigned flags, size_t threads);
 void rill_query_close(struct rill_query *db);
 
+// Rescans the directory: new stores are opened while stores that were merged or
+// expired are dropped once the queries still using them complete. Safe to call
+// while queries are running.
+bool rill_query_refresh(struct rill_query *query);
+
+// Pins the current stores of the query and returns a query over them that
+// isn't affected by later refreshes or rotations. Snapshots keep the threads
+// their query had when they were taken, even if it changes them afterwards,
+// but not its cache.
+struct rill_query *rill_query_snapshot(const struct rill_query *query);
+
+// Fans out queries over a pool of threads. 0 or 1 reverts to querying from the
+// calling thread only. Must not be called while queries are running.
+bool rill_query_threads(struct rill_query *query, size_t threads);
+
+// Caches the results of rill_query_key within a budget of bytes. 0 disables
+// the cache. Must not be called while queries are running.
+bool rill_query_cache(struct rill_query *query, size_t bytes);
+
+struct rill_query_cache_stats
+{
+    size_t hits, misses;
+    size_t entries, bytes;
+};
+
+void rill_query_cache_stats(
+        const struct rill_query *query, struct rill_query_cache_stats *out);
+
+// Makes the lookup sections of the newest stores resident, as with
+// rill_store_resident, within a budget of bytes. Refreshes apply the budget to
+// the stores they add while stores that are already resident keep their copy
+// until they're dropped. Must not be called while queries are running.
+bool rill_query_resident(struct rill_query *query, size_t bytes);
+
+// Sum of rill_store_resident_bytes over the stores of the query.
+size_t rill_query_resident_bytes(const struct rill_query *query);
+
+// Timings of the last time the stores of the query were opened or refreshed.
+void rill_query_open_stats(
+        const struct rill_query *query, struct rill_open_stats *out);
+
 bool rill_query_key(
         const struct rill_query *query,
         enum rill_col col,
@@ -201,9 +451,143 @@ bool rill_query_keys(
         const rill_val_t *keys, size_t len,
         struct rill_rows *out);
 
+// Starts looking up every key over the threads of the query, or a single
+// background thread without them, and returns right away. Completed keys are
+// reaped through rill_query_batch_next. keys must outlive the batch and the
+// threads of the query can't be changed while it's running.
+struct rill_query_batch;
+struct rill_query_batch *rill_query_batch(
+        const struct rill_query *query,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len);
+
+// Waits for the next key to complete, sets key to its index in keys and
+// appends its rows to out. key is set to len once every key was reaped. A
+// failed lookup cancels the batch and is reported once the keys that did
+// complete were reaped.
+bool rill_query_batch_next(
+        struct rill_query_batch *, size_t *key, struct rill_rows *out);
+
+// Lookups that haven't started yet are cancelled.
+void rill_query_batch_free(struct rill_query_batch *);
+
+// Candidates are drawn from the top k of every store and ranked on their number
+// of unique rows across all the stores. A key that is never in the top k of
+// any store won't be found even if its total would place it in the top k.
+bool rill_query_top_keys(
+        const struct rill_query *query,
+        enum rill_col col,
+        size_t k,
+        struct rill_key_count *out,
+        size_t *len);
+
+// Appends the sorted result of the set operation across all stores to out.
+bool rill_query_set(
+        const struct rill_query *query,
+        enum rill_col col,
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out);
+
+// Two-hop expansion of key: gathers the values of key and appends to out the
+// sorted and unique values of their own lists in the other column. In other
+// words, the keys that share at least one value with key, including key.
+bool rill_query_expand(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_vals *out);
+
+struct rill_similar
+{
+    rill_val_t key;
+    double similarity;
+};
+
+// Finds up to k keys of column a with the most similar values to key. Candidates
+// are gathered from the month stores and ranked on their MinHash signatures
+// across all stores. Results are sorted by decreasing similarity.
+bool rill_query_similar(
+        const struct rill_query *query,
+        rill_val_t key,
+        size_t k,
+        struct rill_similar *out,
+        size_t *len);
+
+// Approximate count of the unique values of a key across all stores.
+bool rill_query_sketch(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_sketch *out);
+
+// Only queries the stores that overlap the [from, to) time range.
+bool rill_query_key_range(
+        const struct rill_query *query,
+        enum rill_col col,
+        rill_val_t key,
+        rill_ts_t from, rill_ts_t to,
+        struct rill_rows *out);
+
+bool rill_query_contains(
+        const struct rill_query *query, rill_val_t a, rill_val_t b, bool *out);
+
+// Number of unique rows for the given keys across all stores.
+bool rill_query_count(
+        const struct rill_query *query,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        size_t *out);
+
+// Invoked once for every key of the column along with its sorted and unique
+// values across all the stores. Calls are made concurrently from multiple
+// threads but the keys of a given call are never repeated. Returning false
+// aborts the scan.
+typedef bool (*rill_scan_fn_t) (
+        void *ctx, rill_val_t key, const rill_val_t *vals, size_t len);
+
+// Splits the key space of the column into ranges that are merged across all
+// the stores in parallel. 0 or 1 threads scans from the calling thread only.
+bool rill_query_scan(
+        const struct rill_query *query,
+        enum rill_col col,
+        size_t threads,
+        rill_scan_fn_t fn, void *ctx);
+
+// Streams the rows of a key merged across all stores in sorted order and
+// without duplicates. Ends with a nil row.
+struct rill_query_it;
+
+struct rill_query_it *rill_query_begin(
+        const struct rill_query *query, enum rill_col col, rill_val_t key);
+void rill_query_it_free(struct rill_query_it *it);
+bool rill_query_it_next(struct rill_query_it *it, struct rill_row *out);
+
 
 // -----------------------------------------------------------------------------
 // misc
 // -----------------------------------------------------------------------------
 
 size_t rill_scan_dir(const char *dir, struct rill_store **list, size_t cap);
+
+// Opens the stores listed in the manifest of dir or every store found in dir if
+// it doesn't have one. Stores are opened with flags except for those in open
+// whose file is still listed which are added to list with a new ref instead of
+// being reopened. list must be freed.
+bool rill_open_dir(
+        const char *dir, unsigned flags,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len);
+
+// Same as rill_open_dir but opens the stores over threads and fills stats
+// which may be NULL.
+bool rill_open_dir_threads(
+        const char *dir, unsigned flags, size_t threads,
+        struct rill_store ***list, size_t *len,
+        struct rill_store *const *open, size_t open_len,
+        struct rill_open_stats *stats);
+
+// Manifests are kept up to date by rill_acc_write and rill_rotate so they only
+// need to be rebuilt when stores are added to a directory by other means. Files
+// ending in .tmp or .rm are reserved for the updates of the manifest.
+bool rill_manifest_rebuild(const char *dir);
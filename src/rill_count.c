@@ -17,23 +17,41 @@
 
 static void count(struct rill_store *store, enum rill_col col)
 {
-    struct rill_row row;
-    struct rill_store_it *it = rill_store_begin(store, col);
-
-    rill_val_t key = 0;
-    size_t count = 0;
-    while (rill_store_it_next(it, &row)) {
-        if (rill_row_nil(&row)) break;
-
-        if (row.a == key) count++;
-        else {
-            if (key) printf("%lu %p\n", count, (void *) key);
-            count = 1;
-            key = row.a;
-        }
+    size_t len = 0;
+    if (!rill_store_vals_count(store, col, &len)) rill_exit(1);
+
+    rill_val_t *keys = calloc(len, sizeof(*keys));
+    if (!keys) {
+        rill_fail("unable to allocate keys: %lu", len);
+        rill_exit(1);
     }
 
-    rill_store_it_free(it);
+    if (!rill_store_vals(store, col, keys, len, &len)) rill_exit(1);
+
+    for (size_t i = 0; i < len; ++i) {
+        size_t count = 0;
+        if (!rill_store_count(store, col, keys[i], &count)) rill_exit(1);
+        printf("%lu %p\n", count, (void *) keys[i]);
+    }
+
+    free(keys);
+}
+
+static void top(struct rill_store *store, enum rill_col col, size_t k)
+{
+    struct rill_key_count *top = calloc(k, sizeof(*top));
+    if (!top) {
+        rill_fail("unable to allocate top keys: %lu", k);
+        rill_exit(1);
+    }
+
+    size_t len = 0;
+    if (!rill_store_top_keys(store, col, k, top, &len)) rill_exit(1);
+
+    for (size_t i = 0; i < len; ++i)
+        printf("%lu %p\n", top[i].count, (void *) top[i].key);
+
+    free(top);
 }
 
 
@@ -43,21 +61,21 @@ static void count(struct rill_store *store, enum rill_col col)
 
 static void usage()
 {
-    fprintf(stderr, "rill_count -<a|b> <file>\n");
+    fprintf(stderr, "rill_count -<a|b> [-k <n>] <file>\n");
     exit(1);
 }
 
 int main(int argc, char **argv)
 {
-    if (argc != 3) usage();
-
     int opt = 0;
+    size_t k = 0;
     bool col_a = false, col_b = false;
 
-    while ((opt = getopt(argc, argv, "+ab")) != -1) {
+    while ((opt = getopt(argc, argv, "+abk:")) != -1) {
         switch(opt) {
         case 'a': col_a = true; break;
         case 'b': col_b = true; break;
+        case 'k': k = atol(optarg); break;
         default: usage();
         }
     }
@@ -70,7 +88,8 @@ int main(int argc, char **argv)
     struct rill_store *store = rill_store_open(argv[optind]);
     if (!store) rill_exit(1);
 
-    count(store, col);
+    if (k) top(store, col, k);
+    else count(store, col);
 
     rill_store_close(store);
     return 0;
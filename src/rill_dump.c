@@ -17,32 +17,45 @@
 
 static void dump_headers(struct rill_store *store)
 {
+    size_t vals[rill_cols] = {0};
+    for (size_t col = 0; col < rill_cols; ++col) {
+        if (!rill_store_vals_count(store, col, &vals[col])) rill_exit(1);
+    }
+
     printf("version: %u\n", rill_store_version(store));
     printf("ts:      %lu\n", rill_store_ts(store));
     printf("quant:   %lu\n", rill_store_quant(store));
     printf("rows:    %lu\n", rill_store_rows(store));
-    printf("vals[a]: %zu\n", rill_store_vals_count(store, rill_col_a));
-    printf("vals[b]: %zu\n", rill_store_vals_count(store, rill_col_b));
+    printf("vals[a]: %zu\n", vals[rill_col_a]);
+    printf("vals[b]: %zu\n", vals[rill_col_b]);
 }
 
 static void dump_stats(struct rill_store *store)
 {
     struct rill_store_stats stats = {0};
-    rill_store_stats(store, &stats);
-
-    printf("header:   %zu\n", stats.header_bytes);
-    printf("index[a]: %zu\n", stats.index_bytes[rill_col_a]);
-    printf("index[b]: %zu\n", stats.index_bytes[rill_col_b]);
-    printf("rows[a]:  %zu\n", stats.rows_bytes[rill_col_a]);
-    printf("rows[b]:  %zu\n", stats.rows_bytes[rill_col_b]);
+    if (!rill_store_stats(store, &stats)) rill_exit(1);
+
+    printf("header:    %zu\n", stats.header_bytes);
+    printf("index[a]:  %zu\n", stats.index_bytes[rill_col_a]);
+    printf("index[b]:  %zu\n", stats.index_bytes[rill_col_b]);
+    printf("mph[a]:    %zu\n", stats.mph_bytes[rill_col_a]);
+    printf("mph[b]:    %zu\n", stats.mph_bytes[rill_col_b]);
+    printf("filter[a]: %zu\n", stats.filter_bytes[rill_col_a]);
+    printf("filter[b]: %zu\n", stats.filter_bytes[rill_col_b]);
+    printf("hll[a]:    %zu\n", stats.hll_bytes[rill_col_a]);
+    printf("hll[b]:    %zu\n", stats.hll_bytes[rill_col_b]);
+    printf("minhash:   %zu\n", stats.minhash_bytes);
+    printf("rows[a]:   %zu\n", stats.rows_bytes[rill_col_a]);
+    printf("rows[b]:   %zu\n", stats.rows_bytes[rill_col_b]);
 }
 
 static void dump_vals(struct rill_store *store, enum rill_col col)
 {
-    const size_t vals_len = rill_store_vals_count(store, col);
-    rill_val_t *vals = calloc(vals_len, sizeof(*vals));
+    size_t vals_len = 0;
+    if (!rill_store_vals_count(store, col, &vals_len)) rill_exit(1);
 
-    (void) rill_store_vals(store, col, vals, vals_len);
+    rill_val_t *vals = calloc(vals_len, sizeof(*vals));
+    if (!rill_store_vals(store, col, vals, vals_len, &vals_len)) rill_exit(1);
 
     for (size_t i = 0; i < vals_len; ++i)
         printf("0x%lx\n", vals[i]);
@@ -52,12 +65,15 @@ static void dump_vals(struct rill_store *store, enum rill_col col)
 
 static void dump_rows(struct rill_store *store, enum rill_col col)
 {
+    enum { cap = 1024 };
+    struct rill_row rows[cap];
+
     struct rill_store_it *it = rill_store_begin(store, col);
-    struct rill_row row = {0};
+    size_t len = 0;
 
-    while (rill_store_it_next(it, &row)) {
-        if (rill_row_nil(&row)) break;
-        printf("0x%lx 0x%lx\n", row.a, row.b);
+    while (rill_store_it_next_batch(it, rows, cap, &len) && len) {
+        for (size_t i = 0; i < len; ++i)
+            printf("0x%lx 0x%lx\n", rows[i].a, rows[i].b);
     }
 
     rill_store_it_free(it);
@@ -39,7 +39,7 @@ int main(int argc, char **argv)
     size_t len = argc - optind;
     struct rill_store *stores[len];
     for (size_t i = 0; i < len; i++, optind++) {
-        stores[i] = rill_store_open(argv[optind]);
+        stores[i] = rill_store_open_flags(argv[optind], rill_store_scan_once);
         if (!stores[i]) rill_exit(1);
     }
 
@@ -5,6 +5,7 @@
 
 #include "rill.h"
 #include "utils.h"
+#include "manifest.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,23 +22,46 @@
 // rotate
 // -----------------------------------------------------------------------------
 
-static ssize_t expire(rill_ts_t now, struct rill_store **list, ssize_t len)
+// Rotations are planned from the manifest alone which means that only the
+// stores that are merged are ever opened. Entries are sorted from the most
+// recent to the oldest.
+
+static ssize_t expire(
+        const char *dir, rill_ts_t now, struct manifest_entry *list, ssize_t len)
 {
     if (len < 0) return len;
     if (now < expire_secs) return len; // mostly for tests.
 
     size_t i = 0;
     for (; i < (size_t) len; ++i) {
-        if (rill_store_ts(list[i]) < (now - expire_secs)) break;
+        if (list[i].ts < (now - expire_secs)) break;
     }
 
     size_t end = i;
+    if (end == (size_t) len) return len;
+
+    char (*files)[PATH_MAX] = calloc(len - end, sizeof(*files));
+    const char **rm = calloc(len - end, sizeof(*rm));
+    if (!files || !rm) {
+        rill_fail("unable to allocate expired list: %lu", len - end);
+        goto fail;
+    }
+
     for (; i < (size_t) len; ++i) {
-        rill_store_rm(list[i]);
-        list[i] = NULL;
+        rm[i - end] = files[i - end];
+        snprintf(files[i - end], sizeof(files[0]), "%s/%s", dir, list[i].name);
     }
 
+    if (!manifest_update(dir, NULL, rm, len - end)) goto fail;
+
+    free(rm);
+    free(files);
     return end;
+
+  fail:
+    free(rm);
+    free(files);
+    return -1;
 }
 
 static int file_exists(const char *file)
@@ -82,104 +106,112 @@ static bool file_name(
     return true;
 }
 
-static struct rill_store *merge(
+static bool merge(
         const char *dir,
         rill_ts_t ts, rill_ts_t quant,
-        struct rill_store **list, size_t len)
+        const struct manifest_entry *list, size_t len,
+        struct manifest_entry *out)
 {
     assert(len > 0);
     if (len == 1) {
-        struct rill_store *result = list[0];
-        list[0] = NULL;
-        return result;
+        *out = list[0];
+        return true;
+    }
+
+    bool ok = false;
+    size_t opened = 0;
+    struct rill_store **stores = calloc(len, sizeof(*stores));
+    char (*files)[PATH_MAX] = calloc(len, sizeof(*files));
+    const char **rm = calloc(len, sizeof(*rm));
+    if (!stores || !files || !rm) {
+        rill_fail("unable to allocate merge list: %lu", len);
+        goto done;
     }
 
-    char file[PATH_MAX];
-    if (!file_name(dir, ts, quant, file, sizeof(file))) return NULL;
-    if (!rill_store_merge(file, ts, quant, list, len)) return NULL;
+    // Stores are only read through once by merges.
+    for (; opened < len; ++opened) {
+        rm[opened] = files[opened];
+        snprintf(files[opened], sizeof(files[0]), "%s/%s", dir, list[opened].name);
 
-    for (size_t i = 0; i < len; ++i) {
-        rill_store_rm(list[i]);
-        list[i] = NULL;
+        stores[opened] = rill_store_open_flags(files[opened], rill_store_scan_once);
+        if (!stores[opened]) goto done;
     }
 
-    return rill_store_open(file);
+    char file[PATH_MAX], pending[PATH_MAX];
+    if (!file_name(dir, ts, quant, file, sizeof(file))) goto done;
+    manifest_pending(file, pending, sizeof(pending));
+
+    // Rotations are serialized by the directory lock so this can only be the
+    // leftover of one that was interrupted before publishing its output.
+    unlink(pending);
+    if (!rill_store_merge(pending, ts, quant, stores, len)) goto done;
+
+    // The output replaces the inputs in a single manifest update so a crash
+    // can neither lose the rows nor leave them behind twice.
+    if (!manifest_update(dir, file, rm, len)) goto done;
+
+    *out = (struct manifest_entry) { .ts = ts, .quant = quant };
+    const char *name = strrchr(file, '/');
+    snprintf(out->name, sizeof(out->name), "%.*s", NAME_MAX, name ? name + 1 : file);
+    ok = true;
+
+  done:
+    for (size_t i = 0; i < opened; ++i) rill_store_close(stores[i]);
+    free(rm);
+    free(files);
+    free(stores);
+    return ok;
 }
 
+// Merged stores are written over the entries of their inputs which are always
+// ahead of them.
 static ssize_t merge_quant(
         const char *dir,
         rill_ts_t now, rill_ts_t quant,
-        struct rill_store **list, ssize_t len)
+        struct manifest_entry *list, ssize_t len)
 {
     if (len <= 1) return len;
 
     size_t out_len = 0;
-    struct rill_store *out[(size_t) len];
-
     size_t start = 0;
-    rill_ts_t current_quant = rill_store_ts(list[0]) / quant;
+    rill_ts_t current_quant = list[0].ts / quant;
 
     for (size_t i = 0; i < (size_t) len; i++) {
         size_t end = i + 1;
         assert(i >= start);
         assert(end > start);
 
-        size_t next_ts = i + 1 != (size_t) len ? rill_store_ts(list[i + 1]) : -1UL;
-
-        // Useful for debugging
-        /* printf("[%lu,%lu] file=%s, now=%lu(%lu), ts=%lu(%lu), next=%lu(%lu), earliest=%lu(%lu)\n", */
-        /*         quant, i, rill_store_file(list[i]), now, now / quant, */
-        /*         rill_store_ts(list[i]), rill_store_ts(list[i]) / quant, */
-        /*         i + 1 != (size_t) len ? rill_store_ts(list[i + 1]) : 0, */
-        /*         i + 1 != (size_t) len ? rill_store_ts(list[i + 1]) / quant : 0, */
-        /*         rill_store_ts(list[start]), rill_store_ts(list[start]) / quant); */
-
+        size_t next_ts = i + 1 != (size_t) len ? list[i + 1].ts : -1UL;
         if (next_ts / quant == current_quant) continue;
 
-        rill_ts_t earliest_ts = rill_store_ts(list[start]);
-        if (earliest_ts / quant != now / quant) {
-            struct rill_store *store = merge(dir, earliest_ts, quant, list + start, end - start);
-            if (!store) goto fail;
-            out[out_len++] = store;
-        }
-
         // if a file is in the quant represented by now then we don't want to
         // merge it as we're still filling in this quant. Additionally, if it's
         // in our current quant then it will also be in all bigger quants so we
         // can just forget these files for the rest of the rotation.
-        else {
-            for (size_t j = start; j < end; ++j) {
-                rill_store_close(list[j]);
-                list[j] = NULL;
-            }
+        rill_ts_t earliest_ts = list[start].ts;
+        if (earliest_ts / quant != now / quant) {
+            struct manifest_entry *out = &list[out_len++];
+            if (!merge(dir, earliest_ts, quant, list + start, end - start, out))
+                return -1;
         }
 
         current_quant = next_ts / quant;
         start = i + 1;
     }
 
-    for (size_t i = 0; i < (size_t) len; ++i) assert(!list[i]);
-    memcpy(list, out, out_len * sizeof(out[0]));
     return out_len;
-
-  fail:
-    for (size_t i = 0; i < out_len; ++i)
-        rill_store_close(out[i]);
-
-    return -1;
 }
 
-static int store_cmp(const void *l, const void *r)
+static int entry_cmp(const void *l, const void *r)
 {
-    const struct rill_store *const *lhs = l;
-    const struct rill_store *const *rhs = r;
+    const struct manifest_entry *lhs = l;
+    const struct manifest_entry *rhs = r;
 
     // earliest (biggest) to oldest (smallest)
-    if (rill_store_ts(*lhs) < rill_store_ts(*rhs)) return +1;
-    if (rill_store_ts(*lhs) > rill_store_ts(*rhs)) return -1;
+    if (lhs->ts < rhs->ts) return +1;
+    if (lhs->ts > rhs->ts) return -1;
     return 0;
 }
-
 // Note that an flock is released on process termination on linux. This means
 // that we don't have to worry about cleaning up in case of segfaults or signal
 // termination.
@@ -214,22 +246,21 @@ bool rill_rotate(const char *dir, rill_ts_t now)
     if (!fd) return true;
     if (fd == -1) return false;
 
-    enum { cap = 1024 };
-    struct rill_store *list[cap];
-    size_t list_len = rill_scan_dir(dir, list, cap);
-    qsort(list, list_len, sizeof(list[0]), store_cmp);
-
-    ssize_t len = list_len;
-    len = expire(now, list, len);
-    len = merge_quant(dir, now, hour_secs, list, len);
-    len = merge_quant(dir, now, day_secs, list, len);
-    len = merge_quant(dir, now, week_secs, list, len);
-    len = merge_quant(dir, now, month_secs, list, len);
-
-    for (size_t i = 0; i < list_len; ++i) {
-        if (list[i]) rill_store_close(list[i]);
+    struct manifest manifest = {0};
+    if (!manifest_list(dir, &manifest)) {
+        unlock(fd);
+        return false;
     }
+    qsort(manifest.list, manifest.len, sizeof(manifest.list[0]), entry_cmp);
+
+    ssize_t len = manifest.len;
+    len = expire(dir, now, manifest.list, len);
+    len = merge_quant(dir, now, hour_secs, manifest.list, len);
+    len = merge_quant(dir, now, day_secs, manifest.list, len);
+    len = merge_quant(dir, now, week_secs, manifest.list, len);
+    len = merge_quant(dir, now, month_secs, manifest.list, len);
 
+    manifest_free(&manifest);
     unlock(fd);
     return len >= 0;
 }
@@ -134,3 +134,67 @@ void rill_rows_print(const struct rill_rows *rows)
 
     if (rows->len) printf(" ]\n");
 }
+
+
+// -----------------------------------------------------------------------------
+// vals
+// -----------------------------------------------------------------------------
+
+void rill_vals_free(struct rill_vals *vals)
+{
+    free(vals->data);
+}
+
+void rill_vals_clear(struct rill_vals *vals)
+{
+    vals->len = 0;
+}
+
+bool rill_vals_reserve(struct rill_vals *vals, size_t cap)
+{
+    if (rill_likely(cap <= vals->cap)) return true;
+
+    size_t new_cap = vals->cap ? vals->cap : 1;
+    while (new_cap < cap) new_cap *= 2;
+
+    rill_val_t *data = realloc(vals->data, new_cap * sizeof(vals->data[0]));
+    if (!data) {
+        rill_fail("unable to realloc vals: cap=%lu", new_cap);
+        return false;
+    }
+
+    vals->data = data;
+    vals->cap = new_cap;
+    return true;
+}
+
+bool rill_vals_push(struct rill_vals *vals, rill_val_t val)
+{
+    if (!rill_vals_reserve(vals, vals->len + 1)) return false;
+    vals->data[vals->len++] = val;
+    return true;
+}
+
+static int val_cmp(const void *l, const void *r)
+{
+    rill_val_t lhs = *((const rill_val_t *) l);
+    rill_val_t rhs = *((const rill_val_t *) r);
+
+    if (lhs < rhs) return -1;
+    if (lhs > rhs) return +1;
+    return 0;
+}
+
+void rill_vals_compact(struct rill_vals *vals)
+{
+    if (vals->len <= 1) return;
+    qsort(vals->data, vals->len, sizeof(vals->data[0]), &val_cmp);
+
+    size_t j = 0;
+    for (size_t i = 1; i < vals->len; ++i) {
+        if (vals->data[i] == vals->data[j]) continue;
+        vals->data[++j] = vals->data[i];
+    }
+
+    vals->len = j + 1;
+}
@@ -0,0 +1,115 @@
+/* set.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "set.h"
+#include "rill.h"
+#include "utils.h"
+
+
+// -----------------------------------------------------------------------------
+// gallop
+// -----------------------------------------------------------------------------
+
+// Past this ratio between the length of two lists it becomes cheaper to gallop
+// through the longer list then to walk both.
+enum { set_gallop_ratio = 32 };
+
+// Index of the first element of data that is greater or equal to key starting
+// from start. Probes at exponentially increasing distances before narrowing
+// down with a binary search which keeps the cost proportional to the distance
+// travelled instead of the length of the list.
+static size_t set_gallop(const uint64_t *data, size_t len, size_t start, uint64_t key)
+{
+    if (start >= len || data[start] >= key) return start;
+
+    size_t low = start, step = 1;
+    while (low + step < len && data[low + step] < key) {
+        low += step;
+        step *= 2;
+    }
+
+    size_t high = low + step < len ? low + step : len;
+    while (low + 1 < high) {
+        size_t mid = low + (high - low) / 2;
+        if (data[mid] < key) low = mid;
+        else high = mid;
+    }
+
+    return high;
+}
+
+
+// -----------------------------------------------------------------------------
+// ops
+// -----------------------------------------------------------------------------
+
+size_t set_intersect(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out)
+{
+    if (a_len > b_len) {
+        const uint64_t *tmp = a; a = b; b = tmp;
+        size_t tmp_len = a_len; a_len = b_len; b_len = tmp_len;
+    }
+
+    size_t len = 0;
+
+    if (a_len * set_gallop_ratio < b_len) {
+        size_t j = 0;
+        for (size_t i = 0; i < a_len; ++i) {
+            j = set_gallop(b, b_len, j, a[i]);
+            if (j == b_len) break;
+            if (b[j] == a[i]) out[len++] = a[i];
+        }
+        return len;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else { out[len++] = a[i]; i++; j++; }
+    }
+
+    return len;
+}
+
+size_t set_union(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out)
+{
+    size_t len = 0, i = 0, j = 0;
+
+    while (i < a_len && j < b_len) {
+        if (a[i] < b[j]) out[len++] = a[i++];
+        else if (a[i] > b[j]) out[len++] = b[j++];
+        else { out[len++] = a[i]; i++; j++; }
+    }
+
+    while (i < a_len) out[len++] = a[i++];
+    while (j < b_len) out[len++] = b[j++];
+
+    return len;
+}
+
+size_t set_diff(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out)
+{
+    size_t len = 0, j = 0;
+    bool gallop = a_len * set_gallop_ratio < b_len;
+
+    for (size_t i = 0; i < a_len; ++i) {
+        if (gallop) j = set_gallop(b, b_len, j, a[i]);
+        else while (j < b_len && b[j] < a[i]) j++;
+
+        if (j == b_len || b[j] != a[i]) out[len++] = a[i];
+    }
+
+    return len;
+}
@@ -0,0 +1,36 @@
+/* set.h
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+// Operations over sorted lists of unique integers. Used on both ordinals within
+// a store and values across stores. All return the length of out.
+//
+// out can alias either inputs for intersect and diff but not for union which
+// requires a_len + b_len slots.
+
+size_t set_intersect(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out);
+
+size_t set_union(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out);
+
+// Elements of a that aren't in b.
+size_t set_diff(
+        const uint64_t *a, size_t a_len,
+        const uint64_t *b, size_t b_len,
+        uint64_t *out);
@@ -6,15 +6,18 @@
 #include "rill.h"
 #include "utils.h"
 #include "htable.h"
+#include "set.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <math.h>
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -27,18 +30,26 @@
 #include "index.c"
 #include "vals.c"
 #include "coder.c"
+#include "mph.c"
+#include "filter.c"
+#include "hll.c"
+#include "minhash.c"
 
 // -----------------------------------------------------------------------------
 // store
 // -----------------------------------------------------------------------------
 
 /* version 6 introduces reverse lookup, and massive db format changes */
-static const uint32_t version = 6;
+/* version 7 introduces minimal perfect hash sections for key lookups */
+/* version 8 introduces key filter sections */
+/* version 9 introduces hll sketch sections */
+/* version 10 introduces minhash sections for month stores */
+static const uint32_t version = 10;
 
 static const uint32_t magic = 0x4C4C4952;
 static const uint64_t stamp = 0xFFFFFFFFFFFFFFFFUL;
 /* version 6 can not support older dbs -- they'll need to be updated */
-static const uint32_t supported_versions[] = { 6 };
+static const uint32_t supported_versions[] = { 6, 7, 8, 9, 10 };
 
 struct rill_packed header
 {
@@ -56,12 +67,35 @@ struct rill_packed header
     uint64_t __unused[2];
 
     uint64_t stamp;
+
+    // Fields past the stamp are only valid for the version they were
+    // introduced in and onwards. Sections with an offset of 0 are absent.
+
+    uint64_t mph_off[rill_cols]; // version 7
+    uint64_t filter_off[rill_cols]; // version 8
+    uint64_t hll_off[rill_cols]; // version 9
+    uint64_t minhash_off; // version 10
+};
+
+// Lazy stores keep a copy of their header and filters on the heap and only get
+// mapped when a query gets past the filters.
+struct store_lazy
+{
+    struct header head;
+
+    pthread_mutex_t lock; // serializes mapping and unmapping.
+    size_t state; // store_mapped | pins * store_pin_inc
+    size_t tick; // last use as of the lru clock.
 };
 
 struct rill_store
 {
+    size_t refs;
+
     int fd;
     const char *file;
+    unsigned flags;
+    struct store_lazy lazy;
 
     void *vma;
     size_t vma_len;
@@ -71,7 +105,16 @@ struct rill_store
 
     uint8_t *data[rill_cols];
     struct index *index[rill_cols];
+    struct mph *mph[rill_cols];
+    struct filter *filter[rill_cols];
+    struct hll *hll[rill_cols];
+    struct minhash *minhash;
     uint8_t *end;
+
+    // Anonymous copy of the lookup sections which outlives the mappings of
+    // lazy stores.
+    uint8_t *resident;
+    size_t resident_len, resident_cap;
 };
 
 
@@ -85,6 +128,22 @@ static inline void *store_ptr(struct rill_store *store, uint64_t off)
     return (void *) ((uintptr_t) store->vma + off);
 }
 
+static void *store_section(struct rill_store *store, uint32_t since, uint64_t off)
+{
+    if (store->head->version < since || !off) return NULL;
+    if (off >= store->vma_len) return NULL;
+    return store_ptr(store, off);
+}
+
+// Sketches are the only sections that live past the data.
+// Relies on the header alone as the sections of lazy stores come and go.
+static size_t store_data_end(const struct rill_store *store)
+{
+    uint64_t off = store->head->version >= 9 ? store->head->hll_off[rill_col_a] : 0;
+    if (off && off < store->vma_len) return off;
+    return store->vma_len;
+}
+
 static struct encoder store_encoder(
         struct rill_store *store,
         enum rill_col col,
@@ -115,7 +174,7 @@ static struct decoder store_decoder_at(
 
     size_t start = store->head->data_off[col];
     size_t end = col == rill_col_a ?
-        store->head->data_off[other_col] : store->vma_len;
+        store->head->data_off[other_col] : store_data_end(store);
 
     return make_decoder_at(
             store->vma + start + off,
@@ -131,6 +190,74 @@ static struct decoder store_decoder(
 }
 
 
+// -----------------------------------------------------------------------------
+// advise
+// -----------------------------------------------------------------------------
+
+// The access mode of a store is applied to each of its regions when it gets
+// mapped. Random access prefetches the header along with the index, mph and
+// filter sections that precede the rows as every key lookup goes through them,
+// and disables readahead on the rows and sketches. The sequential modes only
+// bump the readahead of the rows as their stores might never be iterated.
+//
+// Stores opened in scan once mode also drop the pages of their rows from the
+// page cache once a cursor moves past them. This keeps merges from evicting
+// the working set of queries. Pages mapped elsewhere aren't dropped by the
+// kernel, so queries on the same files are unaffected.
+
+enum { store_drop_len = 1 << 20 };
+
+static const unsigned store_modes =
+    rill_store_random | rill_store_sequential | rill_store_scan_once;
+
+static void store_madvise(
+        const struct rill_store *store, uint64_t start, uint64_t end, int advice)
+{
+    start &= ~(page_len - 1);
+    if (end > store->vma_len) end = store->vma_len;
+    if (start >= end) return;
+
+    // Advice is only a hint so failures are ignored.
+    (void) madvise((uint8_t *) store->vma + start, end - start, advice);
+}
+
+static void store_advise(const struct rill_store *store)
+{
+    unsigned mode = store->flags & store_modes;
+    if (!mode) return;
+
+    uint64_t data = store->head->data_off[rill_col_a];
+    uint64_t end = store_data_end(store);
+
+    if (mode & rill_store_random) {
+        store_madvise(store, 0, data, MADV_WILLNEED);
+        store_madvise(store, data, end, MADV_RANDOM);
+        store_madvise(store, end, store->vma_len, MADV_RANDOM);
+    }
+    else store_madvise(store, data, end, MADV_SEQUENTIAL);
+}
+
+// Drops the pages of the rows in [dropped, it) once there's enough of them to
+// be worth the syscalls or once the cursor is done.
+static void store_drop_behind(
+        const struct rill_store *store, uint64_t *dropped, const uint8_t *it, bool done)
+{
+    if (!(store->flags & rill_store_scan_once)) return;
+
+    uint64_t end = it - (const uint8_t *) store->vma;
+    if (!done) end &= ~(page_len - 1);
+
+    if (end <= *dropped) return;
+    if (!done && end - *dropped < store_drop_len) return;
+
+    store_madvise(store, *dropped, end, MADV_DONTNEED);
+    if (store->fd != -1)
+        (void) posix_fadvise(store->fd, *dropped, end - *dropped, POSIX_FADV_DONTNEED);
+
+    *dropped = end;
+}
+
+
 // -----------------------------------------------------------------------------
 // open
 // -----------------------------------------------------------------------------
@@ -142,8 +269,132 @@ static bool is_supported_version(uint32_t version)
     return false;
 }
 
+static bool store_check(struct rill_store *store)
+{
+    if (store->head->magic != magic) {
+        rill_fail("invalid magic '0x%x' for '%s'", store->head->magic, store->file);
+        return false;
+    }
+
+    if (!is_supported_version(store->head->version)) {
+        rill_fail("invalid version '%u' for '%s'", store->head->version, store->file);
+        return false;
+    }
+
+    if (store->head->stamp != stamp) {
+        rill_fail("invalid stamp '%lx' for '%s'", store->head->stamp, store->file);
+        return false;
+    }
+
+    return true;
+}
+
+// Sections that precede the rows are read from the resident copy if there's
+// one which also makes them available while the store isn't mapped.
+static void *store_lookup(struct rill_store *store, uint32_t since, uint64_t off)
+{
+    if (store->head->version < since || !off || off >= store->vma_len) return NULL;
+
+    uint64_t start = store->head->index_off[rill_col_a];
+    if (store->resident && off >= start && off < start + store->resident_len)
+        return store->resident + (off - start);
+
+    return store_ptr(store, off);
+}
+
+// Lazy stores keep their heap copy of the filters.
+static void store_setup_lookup(struct rill_store *store)
+{
+    for (size_t col = 0; col < rill_cols; ++col) {
+        store->index[col] = store_lookup(store, 0, store->head->index_off[col]);
+        store->mph[col] = store_lookup(store, 7, store->head->mph_off[col]);
+        if (!(store->flags & rill_store_lazy))
+            store->filter[col] = store_lookup(store, 8, store->head->filter_off[col]);
+    }
+}
+
+// The lookup sections of resident stores never move once set which allows
+// them to be used without pinning the store.
+static void store_setup(struct rill_store *store)
+{
+    if (!store->resident) store_setup_lookup(store);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        store->data[col] = store_ptr(store, store->head->data_off[col]);
+        store->hll[col] = store_section(store, 9, store->head->hll_off[col]);
+    }
+    store->end = store_ptr(store, store->vma_len);
+    store->minhash = store_section(store, 10, store->head->minhash_off);
+
+    store_advise(store);
+}
+
+static bool store_open_eager(struct rill_store *store, struct rill_open_stats *stats)
+{
+    uint64_t t0 = nsecs_now();
+
+    store->fd = open(store->file, O_RDONLY);
+    if (store->fd == -1) {
+        rill_fail_errno("unable to open '%s'", store->file);
+        goto fail_open;
+    }
+
+    uint64_t t1 = nsecs_now();
+    stats->open_ns += t1 - t0;
+
+    store->vma = mmap(NULL, store->vma_len, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (store->vma == MAP_FAILED) {
+        rill_fail_errno("unable to mmap '%s' of len '%lu'", store->file, store->vma_len);
+        goto fail_mmap;
+    }
+
+    uint64_t t2 = nsecs_now();
+    stats->map_ns += t2 - t1;
+
+    // Checking the header is where the first page gets faulted in.
+    store->head = store->vma;
+    if (!store_check(store)) goto fail_check;
+
+    store_setup(store);
+    stats->check_ns += nsecs_now() - t2;
+    return true;
+
+  fail_check:
+    munmap(store->vma, store->vma_len);
+  fail_mmap:
+    close(store->fd);
+  fail_open:
+    return false;
+}
+
+static bool store_open_lazy(struct rill_store *store, struct rill_open_stats *stats);
+static void store_close_lazy(struct rill_store *store);
+static bool store_resident_init(struct rill_store *store, int fd);
+
 struct rill_store *rill_store_open(const char *file)
 {
+    return rill_store_open_stats(file, 0, NULL);
+}
+
+struct rill_store *rill_store_open_flags(const char *file, unsigned flags)
+{
+    return rill_store_open_stats(file, flags, NULL);
+}
+
+struct rill_store *rill_store_open_stats(
+        const char *file, unsigned flags, struct rill_open_stats *stats)
+{
+    struct rill_open_stats ignored = {0};
+    if (!stats) stats = &ignored;
+
+    if (flags & rill_store_pread) flags |= rill_store_lazy;
+
+    unsigned mode = flags & store_modes;
+    if (mode & (mode - 1)) {
+        rill_fail("conflicting access modes '0x%x' for '%s'", mode, file);
+        goto fail_alloc_struct;
+    }
+
     struct rill_store *store = calloc(1, sizeof(*store));
     if (!store) {
         rill_fail("unable to allocate memory for '%s'", file);
@@ -156,62 +407,34 @@ struct rill_store *rill_store_open(const char *file)
         goto fail_alloc_file;
     }
 
+    uint64_t t0 = nsecs_now();
+
     struct stat stat_ret = {0};
     if (stat(file, &stat_ret) == -1) {
         rill_fail_errno("unable to stat '%s'", file);
         goto fail_stat;
     }
 
+    stats->stat_ns += nsecs_now() - t0;
+
     size_t len = stat_ret.st_size;
     if (len < sizeof(struct header)) {
         rill_fail("invalid size '%lu' for '%s'", len, file);
         goto fail_size;
     }
 
+    store->fd = -1;
+    store->flags = flags;
     store->vma_len = to_vma_len(len);
 
-    store->fd = open(file, O_RDONLY);
-    if (store->fd == -1) {
-        rill_fail_errno("unable to open '%s'", file);
-        goto fail_open;
-    }
-
-    store->vma = mmap(NULL, store->vma_len, PROT_READ, MAP_SHARED, store->fd, 0);
-    if (store->vma == MAP_FAILED) {
-        rill_fail_errno("unable to mmap '%s' of len '%lu'", file, store->vma_len);
-        goto fail_mmap;
-    }
-
-    store->head = store->vma;
-    for (size_t col = 0; col < rill_cols; ++col) {
-        store->index[col] = store_ptr(store, store->head->index_off[col]);
-        store->data[col] = store_ptr(store, store->head->data_off[col]);
-    }
-    store->end = store_ptr(store, store->vma_len);
-
-    if (store->head->magic != magic) {
-        rill_fail("invalid magic '0x%x' for '%s'", store->head->magic, file);
-        goto fail_magic;
-    }
-
-    if (!is_supported_version(store->head->version)) {
-        rill_fail("invalid version '%u' for '%s'", store->head->version, file);
-        goto fail_version;
-    }
-
-    if (store->head->stamp != stamp) {
-        rill_fail("invalid stamp '%lx' for '%s'", store->head->stamp, file);
-        goto fail_stamp;
-    }
+    bool ok = flags & rill_store_lazy ?
+        store_open_lazy(store, stats) : store_open_eager(store, stats);
+    if (!ok) goto fail_open;
 
+    store->refs = 1;
+    stats->stores++;
     return store;
 
-  fail_version:
-  fail_magic:
-  fail_stamp:
-    munmap(store->vma, store->vma_len);
-  fail_mmap:
-    close(store->fd);
   fail_open:
   fail_size:
   fail_stat:
@@ -222,10 +445,23 @@ struct rill_store *rill_store_open(const char *file)
     return NULL;
 }
 
+struct rill_store *rill_store_ref(struct rill_store *store)
+{
+    __atomic_add_fetch(&store->refs, 1, __ATOMIC_RELAXED);
+    return store;
+}
+
 void rill_store_close(struct rill_store *store)
 {
-    munmap(store->vma, store->vma_len);
-    close(store->fd);
+    if (__atomic_sub_fetch(&store->refs, 1, __ATOMIC_ACQ_REL)) return;
+
+    if (store->flags & rill_store_lazy) store_close_lazy(store);
+    else {
+        munmap(store->vma, store->vma_len);
+        close(store->fd);
+    }
+    if (store->resident) munmap(store->resident, store->resident_cap);
+
     free((char *) store->file);
     free(store);
 }
@@ -243,370 +479,1838 @@ bool rill_store_rm(struct rill_store *store)
 
 
 // -----------------------------------------------------------------------------
-// writer
+// lazy
 // -----------------------------------------------------------------------------
 
-static bool writer_open(
-        struct rill_store *store,
-        const char *file,
-        struct vals *vals[rill_cols],
-        size_t rows,
-        rill_ts_t ts,
-        size_t quant)
+// Every access to the mapped sections of a store must be bracketed by
+// store_pin and store_unpin which, for lazy stores, maps the store on demand
+// and keeps it from being unmapped while it's in use. Pins are counted in the
+// same word as the mapped bit so that unmapping boils down to a single CAS from
+// mapped and unpinned to unmapped.
+//
+// Mapped lazy stores are tracked in a process-wide list that is trimmed down to
+// its cap by unmapping the least recently used stores that aren't pinned. Their
+// file stays open for as long as the store is so that it can always be mapped
+// again, even once it was removed or replaced by a rotation.
+
+enum { store_mapped = 1, store_pin_inc = 2 };
+
+static struct
 {
-    store->file = file;
+    pthread_mutex_t lock;
+    size_t cap;
+    size_t tick;
 
-    store->fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0644);
-    if (store->fd == -1) {
-        rill_fail_errno("unable to open '%s'", file);
-        goto fail_open;
-    }
+    size_t len, alloc;
+    struct rill_store **list;
+} store_lru = { .lock = PTHREAD_MUTEX_INITIALIZER, .cap = 256 };
 
-    size_t len = sizeof(struct header);
-    for (size_t col = 0; col < rill_cols; ++col) {
-        len += index_cap(vals[col]->len);
-        len += coder_cap(vals[col]->len, rows);
-    }
+void rill_store_map_cap(size_t cap)
+{
+    __atomic_store_n(&store_lru.cap, cap ? cap : 1, __ATOMIC_RELAXED);
+}
 
-    if (ftruncate(store->fd, len) == -1) {
-        rill_fail_errno("unable to resize '%s'", file);
-        goto fail_truncate;
+static struct filter *store_read_filter(struct rill_store *store, int fd, uint64_t off)
+{
+    struct filter head = {0};
+    ssize_t ret = pread(fd, &head, sizeof(head), off);
+    if (ret != sizeof(head)) {
+        rill_fail_errno("unable to read filter of '%s'", store->file);
+        return NULL;
     }
 
-    store->vma_len = to_vma_len(len);
-    store->vma = mmap(NULL, store->vma_len, PROT_WRITE | PROT_READ, MAP_SHARED, store->fd, 0);
-    if (store->vma == MAP_FAILED) {
-        rill_fail_errno("unable to mmap '%s'", file);
-        goto fail_mmap;
+    size_t len = sizeof(head) + head.len * sizeof(head.blocks[0]);
+    if (off + len > store->vma_len) {
+        rill_fail("invalid filter length '%lu' for '%s'", head.len, store->file);
+        return NULL;
     }
 
-    store->head = store->vma;
-    store->end = store_ptr(store, store->vma_len);
-
-    *store->head = (struct header) {
-        .magic = magic,
-        .version = version,
-        .ts = ts,
-        .quant = quant,
-    };
+    struct filter *filter = malloc(len);
+    if (!filter) {
+        rill_fail("unable to allocate filter for '%s': %lu", store->file, len);
+        return NULL;
+    }
 
-    return true;
+    ret = pread(fd, filter, len, off);
+    if (ret == -1 || (size_t) ret != len) {
+        rill_fail_errno("unable to read filter of '%s'", store->file);
+        free(filter);
+        return NULL;
+    }
 
-    munmap(store->vma, store->vma_len);
-  fail_mmap:
-  fail_truncate:
-    close(store->fd);
-  fail_open:
-    return false;
+    return filter;
 }
 
-static void writer_close(
-        struct rill_store *store, size_t len)
+static bool store_open_lazy(struct rill_store *store, struct rill_open_stats *stats)
 {
-    if (len) {
-        assert(len <= store->vma_len);
-        if (ftruncate(store->fd, len) == -1)
-            rill_fail_errno("unable to resize '%s'", store->file);
+    struct store_lazy *lazy = &store->lazy;
+    uint64_t t0 = nsecs_now();
 
-        if (fdatasync(store->fd) == -1)
-            rill_fail_errno("unable to fdatasync data '%s'", store->file);
+    int fd = open(store->file, O_RDONLY);
+    if (fd == -1) {
+        rill_fail_errno("unable to open '%s'", store->file);
+        goto fail_open;
+    }
 
-        // Indicate that the file has been fully written and is ready for
-        // use. An additional sync is required for the stamp to ensure that the
-        // data is...
-        // - ... properly persisted before we delete it (durability)
-        // - ... only persisted after all the data has been persisted (ordering)
-        store->head->stamp = stamp;
-        if (fdatasync(store->fd) == -1)
-            rill_fail_errno("unable to fdatasync stamp '%s'", store->file);
+    uint64_t t1 = nsecs_now();
+    stats->open_ns += t1 - t0;
+
+    if (pread(fd, &lazy->head, sizeof(lazy->head), 0) != sizeof(lazy->head)) {
+        rill_fail_errno("unable to read header of '%s'", store->file);
+        goto fail_read;
     }
-    else if (unlink(store->file) == -1)
-        rill_fail_errno("unable to unlink '%s'", store->file);
 
-    munmap(store->vma, store->vma_len);
-    close(store->fd);
-}
+    uint64_t t2 = nsecs_now();
+    stats->map_ns += t2 - t1;
 
-static void writer_offsets_init(
-        struct rill_store *store, struct vals *vals[rill_cols])
-{
-    uint64_t off = sizeof(struct header);
+    store->head = &lazy->head;
+    if (!store_check(store)) goto fail_read;
 
-    store->head->index_off[rill_col_a] = off;
-    store->index[rill_col_a] = store_ptr(store, off);
+    uint64_t t3 = nsecs_now();
+    stats->check_ns += t3 - t2;
 
-    off += index_cap(vals[rill_col_a]->len);
+    for (size_t col = 0; col < rill_cols; ++col) {
+        uint64_t off = store->head->version >= 8 ? store->head->filter_off[col] : 0;
+        if (!off || off >= store->vma_len) continue;
 
-    store->head->index_off[rill_col_b] = off;
-    store->index[rill_col_b] = store_ptr(store, off);
+        store->filter[col] = store_read_filter(store, fd, off);
+        if (!store->filter[col]) goto fail_filter;
+    }
 
-    off += index_cap(vals[rill_col_b]->len);
+    if (store->flags & rill_store_pread) {
+        if (!store_resident_init(store, fd)) goto fail_filter;
+    }
 
-    store->head->data_off[rill_col_a] = off;
-    store->data[rill_col_a] = store_ptr(store, off);
+    store->fd = fd;
+    stats->map_ns += nsecs_now() - t3;
+
+    pthread_mutex_init(&lazy->lock, NULL);
+    return true;
+
+  fail_filter:
+    for (size_t col = 0; col < rill_cols; ++col) free(store->filter[col]);
+  fail_read:
+    close(fd);
+  fail_open:
+    return false;
 }
 
-static void writer_offsets_finish(struct rill_store *store, size_t off)
+static void store_lru_del(struct rill_store *store)
 {
-    store->head->data_off[rill_col_b] = store->head->data_off[rill_col_a] + off;
-    store->data[rill_col_b] = store_ptr(store, off);
+    for (size_t i = 0; i < store_lru.len; ++i) {
+        if (store_lru.list[i] != store) continue;
+        store_lru.list[i] = store_lru.list[--store_lru.len];
+        return;
+    }
 }
 
-bool rill_store_write(
-        const char *file,
-        rill_ts_t ts, size_t quant,
-        struct rill_rows *rows)
+static void store_unmap(struct rill_store *store)
 {
-    rill_rows_compact(rows);
-    if (!rows->len) return true;
+    munmap(store->vma, store->vma_len);
+    store->vma = NULL;
+    store->end = NULL;
+    store->minhash = NULL;
 
-    struct vals *vals[rill_cols] = {0};
     for (size_t col = 0; col < rill_cols; ++col) {
-        vals[col] = vals_for_col(rows, col);
-        if (!vals[col]) goto fail_vals;
+        store->data[col] = NULL;
+        store->hll[col] = NULL;
+        if (store->resident) continue;
+        store->index[col] = NULL;
+        store->mph[col] = NULL;
+    }
+}
+
+// Stores that are in use or being mapped by another thread are left alone.
+static bool store_lru_evict(struct rill_store *store)
+{
+    struct store_lazy *lazy = &store->lazy;
+    if (pthread_mutex_trylock(&lazy->lock)) return false;
+
+    size_t state = store_mapped;
+    bool evicted = __atomic_compare_exchange_n(
+            &lazy->state, &state, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    if (evicted) store_unmap(store);
+
+    pthread_mutex_unlock(&lazy->lock);
+    return evicted;
+}
+
+static void store_lru_add(struct rill_store *store)
+{
+    pthread_mutex_lock(&store_lru.lock);
+
+    if (store_lru.len == store_lru.alloc) {
+        size_t alloc = store_lru.alloc ? store_lru.alloc * 2 : 64;
+        struct rill_store **list = realloc(store_lru.list, alloc * sizeof(*list));
+
+        // Untracked stores stay mapped until they're closed.
+        if (!list) goto done;
+
+        store_lru.list = list;
+        store_lru.alloc = alloc;
+    }
+
+    store->lazy.tick = __atomic_add_fetch(&store_lru.tick, 1, __ATOMIC_RELAXED);
+    store_lru.list[store_lru.len++] = store;
+
+    size_t cap = __atomic_load_n(&store_lru.cap, __ATOMIC_RELAXED);
+    size_t attempts = store_lru.len;
+
+    while (store_lru.len > cap && attempts--) {
+        size_t victim = store_lru.len;
+        for (size_t i = 0; i < store_lru.len; ++i) {
+            struct rill_store *other = store_lru.list[i];
+            if (other == store) continue;
+            if (__atomic_load_n(&other->lazy.state, __ATOMIC_RELAXED) != store_mapped)
+                continue;
+
+            if (victim == store_lru.len ||
+                    other->lazy.tick < store_lru.list[victim]->lazy.tick)
+                victim = i;
+        }
+        if (victim == store_lru.len) break;
+
+        struct rill_store *other = store_lru.list[victim];
+        if (store_lru_evict(other)) store_lru_del(other);
+        else other->lazy.tick = __atomic_load_n(&store_lru.tick, __ATOMIC_RELAXED);
+    }
+
+  done:
+    pthread_mutex_unlock(&store_lru.lock);
+}
+
+static bool store_map(struct rill_store *store)
+{
+    struct store_lazy *lazy = &store->lazy;
+    pthread_mutex_lock(&lazy->lock);
+
+    if (__atomic_load_n(&lazy->state, __ATOMIC_ACQUIRE) & store_mapped) {
+        __atomic_add_fetch(&lazy->state, store_pin_inc, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&lazy->lock);
+        return true;
+    }
+
+    store->vma = mmap(NULL, store->vma_len, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (store->vma == MAP_FAILED) {
+        rill_fail_errno("unable to mmap '%s' of len '%lu'", store->file, store->vma_len);
+        store->vma = NULL;
+        pthread_mutex_unlock(&lazy->lock);
+        return false;
+    }
+
+    store_setup(store);
+    __atomic_store_n(&lazy->state, store_mapped | store_pin_inc, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lazy->lock);
+
+    store_lru_add(store);
+    return true;
+}
+
+static bool store_pin(const struct rill_store *store)
+{
+    if (rill_likely(!(store->flags & rill_store_lazy))) return true;
+
+    // Pins advance the clock so that a store in use is always more recent than
+    // the stores mapped before it. Stores already at the head of the clock
+    // don't bother to avoid bouncing the counter between threads.
+    struct store_lazy *lazy = (struct store_lazy *) &store->lazy;
+    size_t tick = __atomic_load_n(&store_lru.tick, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&lazy->tick, __ATOMIC_RELAXED) != tick) {
+        tick = __atomic_add_fetch(&store_lru.tick, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&lazy->tick, tick, __ATOMIC_RELAXED);
+    }
+
+    size_t state = __atomic_load_n(&lazy->state, __ATOMIC_ACQUIRE);
+    while (state & store_mapped) {
+        if (__atomic_compare_exchange_n(&lazy->state, &state, state + store_pin_inc,
+                        true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            return true;
+    }
+
+    return store_map((struct rill_store *) store);
+}
+
+static void store_unpin(const struct rill_store *store)
+{
+    if (rill_likely(!(store->flags & rill_store_lazy))) return;
+
+    struct store_lazy *lazy = (struct store_lazy *) &store->lazy;
+    __atomic_sub_fetch(&lazy->state, store_pin_inc, __ATOMIC_RELEASE);
+}
+
+static void store_close_lazy(struct rill_store *store)
+{
+    pthread_mutex_lock(&store_lru.lock);
+    store_lru_del(store);
+    pthread_mutex_unlock(&store_lru.lock);
+
+    if (store->vma) munmap(store->vma, store->vma_len);
+    if (store->fd != -1) close(store->fd);
+    for (size_t col = 0; col < rill_cols; ++col) free(store->filter[col]);
+    pthread_mutex_destroy(&store->lazy.lock);
+}
+
+// Lazy stores only get mapped once their filter lets the key through.
+static bool store_skip(const struct rill_store *store, enum rill_col col, rill_val_t key)
+{
+    return store->filter[col] && !filter_test(store->filter[col], key);
+}
+
+
+// -----------------------------------------------------------------------------
+// resident
+// -----------------------------------------------------------------------------
+
+// The index, mph and filter sections sit between the header and the rows which
+// makes them a single region that can be copied in one go. Copies are made in
+// anonymous memory so that they can't be evicted by the page cache, with huge
+// pages when the region is large enough to make use of them.
+
+enum { store_huge_page_len = 1 << 21 };
+
+// Filled in by either copying the mapping or, for pread stores, reading the
+// file.
+static bool store_resident_init(struct rill_store *store, int fd)
+{
+    uint64_t start = store->head->index_off[rill_col_a];
+    size_t len = store->head->data_off[rill_col_a] - start;
+
+    size_t align = len >= store_huge_page_len ? store_huge_page_len : page_len;
+    size_t cap = (len + align - 1) & ~(align - 1);
+
+    void *ptr = mmap(NULL, cap,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        rill_fail_errno("unable to allocate resident copy of '%s': %lu", store->file, cap);
+        return false;
+    }
+
+    // Both are only hints and the copy is still useful without them.
+    if (align == store_huge_page_len) (void) madvise(ptr, cap, MADV_HUGEPAGE);
+
+    if (fd == -1) memcpy(ptr, (uint8_t *) store->vma + start, len);
+    else {
+        ssize_t ret = pread(fd, ptr, len, start);
+        if (ret == -1 || (size_t) ret != len) {
+            rill_fail_errno("unable to read lookup sections of '%s'", store->file);
+            munmap(ptr, cap);
+            return false;
+        }
+    }
+    (void) mprotect(ptr, cap, PROT_READ);
+
+    store->resident = ptr;
+    store->resident_len = len;
+    store->resident_cap = cap;
+    store_setup_lookup(store);
+    return true;
+}
+
+bool rill_store_resident(struct rill_store *store)
+{
+    if (store->resident) return true;
+    if (!store_pin(store)) return false;
+
+    bool ok = store_resident_init(store, -1);
+
+    store_unpin(store);
+    return ok;
+}
+
+size_t rill_store_resident_bytes(const struct rill_store *store)
+{
+    return store->resident ? store->resident_len : 0;
+}
+
+size_t rill_store_lookup_bytes(const struct rill_store *store)
+{
+    return store->head->data_off[rill_col_a] - store->head->index_off[rill_col_a];
+}
+
+
+// -----------------------------------------------------------------------------
+// writer
+// -----------------------------------------------------------------------------
+
+static bool writer_open(
+        struct rill_store *store,
+        const char *file,
+        struct vals *vals[rill_cols],
+        size_t rows,
+        rill_ts_t ts,
+        size_t quant)
+{
+    store->file = file;
+
+    store->fd = open(file, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (store->fd == -1) {
+        rill_fail_errno("unable to open '%s'", file);
+        goto fail_open;
+    }
+
+    size_t len = sizeof(struct header);
+    for (size_t col = 0; col < rill_cols; ++col) {
+        len += index_cap(vals[col]->len);
+        len += mph_cap(vals[col]->len);
+        len += filter_cap(vals[col]->len);
+        len += coder_cap(vals[col]->len, rows);
+        len += hll_cap(rows);
+    }
+    if (quant >= month_secs) len += minhash_cap(rows);
+
+    if (ftruncate(store->fd, len) == -1) {
+        rill_fail_errno("unable to resize '%s'", file);
+        goto fail_truncate;
+    }
+
+    store->vma_len = to_vma_len(len);
+    store->vma = mmap(NULL, store->vma_len, PROT_WRITE | PROT_READ, MAP_SHARED, store->fd, 0);
+    if (store->vma == MAP_FAILED) {
+        rill_fail_errno("unable to mmap '%s'", file);
+        goto fail_mmap;
+    }
+
+    store->head = store->vma;
+    store->end = store_ptr(store, store->vma_len);
+
+    *store->head = (struct header) {
+        .magic = magic,
+        .version = version,
+        .ts = ts,
+        .quant = quant,
+    };
+
+    return true;
+
+    munmap(store->vma, store->vma_len);
+  fail_mmap:
+  fail_truncate:
+    close(store->fd);
+  fail_open:
+    return false;
+}
+
+static void writer_close(
+        struct rill_store *store, size_t len)
+{
+    if (len) {
+        assert(len <= store->vma_len);
+        if (ftruncate(store->fd, len) == -1)
+            rill_fail_errno("unable to resize '%s'", store->file);
+
+        if (fdatasync(store->fd) == -1)
+            rill_fail_errno("unable to fdatasync data '%s'", store->file);
+
+        // Indicate that the file has been fully written and is ready for
+        // use. An additional sync is required for the stamp to ensure that the
+        // data is...
+        // - ... properly persisted before we delete it (durability)
+        // - ... only persisted after all the data has been persisted (ordering)
+        store->head->stamp = stamp;
+        if (fdatasync(store->fd) == -1)
+            rill_fail_errno("unable to fdatasync stamp '%s'", store->file);
+    }
+    else if (unlink(store->file) == -1)
+        rill_fail_errno("unable to unlink '%s'", store->file);
+
+    munmap(store->vma, store->vma_len);
+    close(store->fd);
+}
+
+static void writer_offsets_init(
+        struct rill_store *store, struct vals *vals[rill_cols])
+{
+    uint64_t off = sizeof(struct header);
+
+    store->head->index_off[rill_col_a] = off;
+    store->index[rill_col_a] = store_ptr(store, off);
+
+    off += index_cap(vals[rill_col_a]->len);
+
+    store->head->index_off[rill_col_b] = off;
+    store->index[rill_col_b] = store_ptr(store, off);
+
+    off += index_cap(vals[rill_col_b]->len);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        store->head->mph_off[col] = off;
+        store->mph[col] = store_ptr(store, off);
+        off += mph_cap(vals[col]->len);
+    }
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        store->head->filter_off[col] = off;
+        store->filter[col] = store_ptr(store, off);
+        off += filter_cap(vals[col]->len);
+    }
+
+    store->head->data_off[rill_col_a] = off;
+    store->data[rill_col_a] = store_ptr(store, off);
+}
+
+// Builds the filter and mph sections from the sorted keys of each column. The
+// mph is an optional section so failing to build it only means that lookups
+// will fall back to a binary search of the index. The keys go through a void
+// pointer as vals is packed.
+static void writer_keys(struct rill_store *store, struct vals *vals[rill_cols])
+{
+    for (size_t col = 0; col < rill_cols; ++col) {
+        const void *keys = vals[col]->data;
+        filter_build(store->filter[col], keys, vals[col]->len);
+
+        if (mph_build(store->mph[col], keys, vals[col]->len))
+            continue;
+
+        store->head->mph_off[col] = 0;
+        store->mph[col] = NULL;
+    }
+}
+
+static void writer_offsets_finish(struct rill_store *store, size_t off)
+{
+    store->head->data_off[rill_col_b] = store->head->data_off[rill_col_a] + off;
+    store->data[rill_col_b] = store_ptr(store, off);
+}
+
+static size_t store_count_at(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        uint64_t off);
+
+static bool writer_hll(
+        struct rill_store *store, enum rill_col col, uint64_t *off)
+{
+    struct index *index = store->index[col];
+    struct hll *hll = store_ptr(store, *off);
+
+    hll->len = 0;
+    for (size_t i = 0; i < index->len; ++i) {
+        if (store_count_at(store, col, i, index->data[i].off) >= hll_min_degree)
+            hll->keys[hll->len++] = i;
+    }
+    memset(hll_regs_at(hll, 0), 0, hll->len * hll_regs);
+
+    for (size_t i = 0; i < hll->len; ++i) {
+        size_t key_idx = hll->keys[i];
+        rill_val_t key = index->data[key_idx].key;
+        uint8_t *regs = hll_regs_at(hll, i);
+
+        struct rill_row row = {0};
+        struct decoder coder =
+            store_decoder_at(store, col, key_idx, index->data[key_idx].off);
+
+        while (true) {
+            if (!coder_decode(&coder, &row)) return false;
+            if (rill_row_nil(&row) || row.a != key) break;
+            hll_add(regs, row.b);
+        }
+    }
+
+    store->head->hll_off[col] = *off;
+    store->hll[col] = hll;
+    *off += hll_len(hll);
+    return true;
+}
+
+static bool store_minhash_at(
+        const struct rill_store *store,
+        size_t key_idx,
+        uint64_t off,
+        uint32_t *sig)
+{
+    rill_val_t key = index_get(store->index[rill_col_a], key_idx);
+
+    struct rill_row row = {0};
+    struct decoder coder = store_decoder_at(store, rill_col_a, key_idx, off);
+
+    while (true) {
+        if (!coder_decode(&coder, &row)) return false;
+        if (rill_row_nil(&row) || row.a != key) break;
+        minhash_add(sig, row.b);
+    }
+
+    return true;
+}
+
+static bool writer_minhash(struct rill_store *store, uint64_t *off)
+{
+    struct index *index = store->index[rill_col_a];
+    struct minhash *minhash = store_ptr(store, *off);
+
+    minhash->len = 0;
+    for (size_t i = 0; i < index->len; ++i) {
+        if (store_count_at(store, rill_col_a, i, index->data[i].off) >= minhash_min_degree)
+            minhash->keys[minhash->len++] = i;
+    }
+
+    for (size_t i = 0; i < minhash->len; ++i) {
+        size_t key_idx = minhash->keys[i];
+        uint32_t *sig = minhash_sig(minhash, i);
+
+        minhash_reset(sig);
+        if (!store_minhash_at(store, key_idx, index->data[key_idx].off, sig))
+            return false;
+    }
+
+    minhash_index(minhash);
+
+    store->head->minhash_off = *off;
+    store->minhash = minhash;
+    *off += minhash_len(minhash);
+    return true;
+}
+
+// Sketches are appended after the data as their size isn't known until all the
+// lists have been encoded. Returns the final length of the file in off.
+// MinHash signatures are only worth their size on month stores which are the
+// ones that are kept around and queried the most.
+static bool writer_sketches(struct rill_store *store, uint64_t *off)
+{
+    for (size_t col = 0; col < rill_cols; ++col) {
+        if (!writer_hll(store, col, off)) return false;
+    }
+
+    if (store->head->quant >= month_secs) {
+        if (!writer_minhash(store, off)) return false;
+    }
+
+    return true;
+}
+
+bool rill_store_write(
+        const char *file,
+        rill_ts_t ts, size_t quant,
+        struct rill_rows *rows)
+{
+    rill_rows_compact(rows);
+    if (!rows->len) return true;
+
+    struct vals *vals[rill_cols] = {0};
+    for (size_t col = 0; col < rill_cols; ++col) {
+        vals[col] = vals_for_col(rows, col);
+        if (!vals[col]) goto fail_vals;
     }
 
     struct rill_store store = {0};
     if (!writer_open(&store, file, vals, rows->len, ts, quant)) goto fail_open;
 
-    writer_offsets_init(&store, vals);
+    writer_offsets_init(&store, vals);
+    writer_keys(&store, vals);
+
+    struct encoder coder_a = store_encoder(&store, rill_col_a, vals);
+    for (size_t i = 0; i < rows->len; ++i) {
+        if (!coder_encode(&coder_a, &rows->data[i])) goto fail_encode_a;
+    }
+    if (!coder_finish(&coder_a)) goto fail_encode_a;
+
+    writer_offsets_finish(&store, coder_off(&coder_a));
+    rill_rows_invert(rows);
+
+    struct encoder coder_b = store_encoder(&store, rill_col_b, vals);
+    for (size_t i = 0; i < rows->len; ++i) {
+        if (!coder_encode(&coder_b, &rows->data[i])) goto fail_encode_b;
+    }
+    if (!coder_finish(&coder_b)) goto fail_encode_b;
+
+    uint64_t end = store.head->data_off[rill_col_b] + coder_off(&coder_b);
+    if (!writer_sketches(&store, &end)) goto fail_encode_b;
+
+    store.head->rows = rows->len;
+    writer_close(&store, end);
+
+    coder_close(&coder_a);
+    coder_close(&coder_b);
+
+    for (size_t col = 0; col < rill_cols; ++col)
+        free(vals[col]);
+
+    return true;
+
+  fail_encode_b:
+    coder_close(&coder_b);
+  fail_encode_a:
+    coder_close(&coder_a);
+    writer_close(&store, 0);
+  fail_open:
+    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
+  fail_vals:
+    return false;
+}
+
+
+static bool store_merge_col(
+        struct rill_store** list,
+        size_t list_len,
+        enum rill_col col,
+        struct encoder* coder)
+{
+    struct rill_row rows[list_len];
+    struct decoder decoders[list_len];
+    struct rill_store *stores[list_len];
+    uint64_t dropped[list_len];
+
+    size_t it_len = 0;
+    for (size_t i = 0; i < list_len; ++i) {
+        if (!list[i]) continue;
+        stores[it_len] = list[i];
+        decoders[it_len] = store_decoder(list[i], col);
+        dropped[it_len] = decoders[it_len].it - (uint8_t *) list[i]->vma;
+        it_len++;
+    }
+    assert(it_len);
+
+    for (size_t i = 0; i < it_len; ++i) {
+        if (!(coder_decode(&decoders[i], &rows[i]))) goto fail_decoder;
+    }
+
+    struct rill_row prev = {0};
+    while (it_len > 0) {
+        size_t target = 0;
+
+        for (size_t i = 1; i < it_len; ++i) {
+            if (rill_row_cmp(&rows[i], &rows[target]) < 0)
+                target = i;
+        }
+
+        struct rill_row *row = &rows[target];
+        struct decoder *decoder = &decoders[target];
+
+        if (rill_likely(rill_row_nil(&prev) || rill_row_cmp(&prev, row) < 0)) {
+            if (!coder_encode(coder, row)) goto fail_decoder;
+            prev = *row;
+        }
+
+        if (!coder_decode(decoder, row)) goto fail_decoder;
+
+        bool done = rill_row_nil(row);
+        store_drop_behind(stores[target], &dropped[target], decoder->it, done);
+
+        if (rill_unlikely(done)) {
+            memmove(stores + target,
+                    stores + target + 1,
+                    (it_len - target - 1) * sizeof(stores[0]));
+            memmove(dropped + target,
+                    dropped + target + 1,
+                    (it_len - target - 1) * sizeof(dropped[0]));
+            memmove(rows + target,
+                    rows + target + 1,
+                    (it_len - target - 1) * sizeof(rows[0]));
+            memmove(decoders + target,
+                    decoders + target + 1,
+                    (it_len - target - 1) * sizeof(decoders[0]));
+            it_len--;
+        }
+    }
+
+    return true;
+
+  fail_decoder:
+    return false;
+}
+
+bool rill_store_merge(
+        const char *file,
+        rill_ts_t ts, size_t quant,
+        struct rill_store **list, size_t list_len)
+{
+    assert(list_len > 1);
+
+    size_t rows = 0;
+    struct vals *vals[rill_cols] = {0};
+
+    size_t pinned = 0;
+    for (; pinned < list_len; ++pinned) {
+        if (list[pinned] && !store_pin(list[pinned])) goto fail_pin;
+    }
+
+    for (size_t i = 0; i < list_len; ++i) {
+        if (!list[i]) continue;
+
+        for (size_t col = 0; col < rill_cols; ++col) {
+            struct vals *ret = vals_add_index(vals[col], list[i]->index[col]);
+            if (!ret) goto fail_vals;
+            vals[col] = ret;
+        }
+
+        rows += list[i]->head->rows;
+    }
+
+    struct rill_store store = {0};
+    if (!writer_open(&store, file, vals, rows, ts, quant)) goto fail_open;
+
+    writer_offsets_init(&store, vals);
+    writer_keys(&store, vals);
+
+    struct encoder encoder_a = store_encoder(&store, rill_col_a, vals);
+    if (!store_merge_col(list, list_len, rill_col_a, &encoder_a)) goto fail_coder_a;
+    if (!coder_finish(&encoder_a)) goto fail_coder_a;
+
+    writer_offsets_finish(&store, coder_off(&encoder_a));
+
+    struct encoder encoder_b = store_encoder(&store, rill_col_b, vals);
+    if (!store_merge_col(list, list_len, rill_col_b, &encoder_b)) goto fail_coder_b;
+    if (!coder_finish(&encoder_b)) goto fail_coder_b;
+
+    uint64_t end = store.head->data_off[rill_col_b] + coder_off(&encoder_b);
+    if (!writer_sketches(&store, &end)) goto fail_coder_b;
+
+    store.head->rows = encoder_a.rows;
+    writer_close(&store, end);
+
+    coder_close(&encoder_a);
+    coder_close(&encoder_b);
+
+    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
+    for (size_t i = 0; i < list_len; ++i) if (list[i]) store_unpin(list[i]);
+    return true;
+
+    coder_close(&encoder_b);
+  fail_coder_b:
+    coder_close(&encoder_a);
+  fail_coder_a:
+    writer_close(&store, 0);
+  fail_open:
+  fail_vals:
+    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
+  fail_pin:
+    for (size_t i = 0; i < pinned; ++i) if (list[i]) store_unpin(list[i]);
+    return false;
+}
+
+
+// -----------------------------------------------------------------------------
+// header info
+// -----------------------------------------------------------------------------
+
+const char * rill_store_file(const struct rill_store *store)
+{
+    return store->file;
+}
+
+unsigned rill_store_version(const struct rill_store *store)
+{
+    return store->head->version;
+}
+
+rill_ts_t rill_store_ts(const struct rill_store *store)
+{
+    return store->head->ts;
+}
+
+size_t rill_store_quant(const struct rill_store *store)
+{
+    return store->head->quant;
+}
+
+size_t rill_store_rows(const struct rill_store *store)
+{
+    return store->head->rows;
+}
+
+
+// -----------------------------------------------------------------------------
+// query
+// -----------------------------------------------------------------------------
+
+bool rill_store_vals_count(
+        const struct rill_store *store, enum rill_col col, size_t *out)
+{
+    if (!store_pin(store)) return false;
+    *out = store->index[col]->len;
+    store_unpin(store);
+    return true;
+}
+
+bool rill_store_val_at(
+        const struct rill_store *store, enum rill_col col, size_t i, rill_val_t *out)
+{
+    if (!store_pin(store)) return false;
+    *out = index_get(store->index[col], i);
+    store_unpin(store);
+    return true;
+}
+
+bool rill_store_vals(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t *out,
+        size_t cap,
+        size_t *len)
+{
+    if (!store_pin(store)) return false;
+
+    const struct index* index = store->index[col];
+    *len = cap < index->len ? cap : index->len;
+
+    for (size_t i = 0; i < *len; ++i)
+        out[i] = index->data[i].key;
+
+    store_unpin(store);
+    return true;
+}
+
+
+static bool store_index_find(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t key,
+        size_t *key_idx,
+        uint64_t *off)
+{
+    if (store->filter[col] && !filter_test(store->filter[col], key)) return false;
+
+    struct index *index = store->index[col];
+    if (!store->mph[col]) return index_find(index, key, key_idx, off);
+
+    size_t idx = 0;
+    if (!mph_find(store->mph[col], key, &idx)) return false;
+    if (idx >= index->len || index->data[idx].key != key) return false;
+
+    *key_idx = idx;
+    *off = index->data[idx].off;
+    return true;
+}
+
+// Upper bound on the number of bytes used by the list of a key.
+static size_t store_list_len(
+        const struct rill_store *store, enum rill_col col, size_t key_idx)
+{
+    struct index *index = store->index[col];
+    if (key_idx + 1 < index->len)
+        return index->data[key_idx + 1].off - index->data[key_idx].off;
 
-    struct encoder coder_a = store_encoder(&store, rill_col_a, vals);
-    for (size_t i = 0; i < rows->len; ++i) {
-        if (!coder_encode(&coder_a, &rows->data[i])) goto fail_encode_a;
+    size_t end = col == rill_col_a ?
+        store->head->data_off[rill_col_b] : store_data_end(store);
+    return end - store->head->data_off[col] - index->data[key_idx].off;
+}
+
+// Lists can either come from the mapping or from a buffer they were read into.
+static struct decoder store_list_decoder(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        const uint8_t *list)
+{
+    uint8_t *it = (uint8_t *) list;
+    return make_decoder_at(
+            it, it + store_list_len(store, col, key_idx),
+            store->index[rill_col_flip(col)], store->index[col],
+            key_idx);
+}
+
+static bool store_query_list(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        const uint8_t *list,
+        struct rill_rows *out)
+{
+    rill_val_t key = index_get(store->index[col], key_idx);
+
+    // Counting the list is a lot cheaper then decoding it so we can afford to
+    // size out upfront and decode straight into it.
+    size_t count = coder_count(list, list + store_list_len(store, col, key_idx));
+    if (!rill_rows_reserve(out, out->len + count)) return false;
+
+    size_t len = 0;
+    struct decoder coder = store_list_decoder(store, col, key_idx, list);
+    if (!coder_decode_batch(&coder, key + 1, out->data + out->len, count, &len))
+        return false;
+
+    out->len += len;
+    return true;
+}
+
+static bool store_query_at(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        uint64_t off,
+        struct rill_rows *out)
+{
+    const uint8_t *list = store->vma + store->head->data_off[col] + off;
+    return store_query_list(store, col, key_idx, list, out);
+}
+
+static bool store_pread_query(
+        const struct rill_store *store, enum rill_col col, rill_val_t key,
+        struct rill_rows *out);
+
+bool rill_store_query(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_rows *out)
+{
+    if (store_skip(store, col, key)) return true;
+    if (store->flags & rill_store_pread) return store_pread_query(store, col, key, out);
+    if (!store_pin(store)) return false;
+
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    bool ok = !store_index_find(store, col, key, &key_idx, &off) ||
+        store_query_at(store, col, key_idx, off, out);
+
+    store_unpin(store);
+    return ok;
+}
+
+// Lists are looked up in two phases: the offsets of a window of lists are
+// first resolved from the index and the pages they span are handed to the
+// kernel as a handful of coalesced ranges before any of them get decoded. On
+// stores that aren't in the page cache, this turns a fault per list into
+// readahead requests that keep the disk queue busy. While decoding, the first
+// cache line of the lists a little further ahead is prefetched as well.
+//
+// Lists that are closer than the gap are coalesced into a single range as
+// reading the pages in between is cheaper than an extra request.
+
+enum
+{
+    store_join_window = 1024,
+    store_join_ahead = 32,
+    store_join_gap = 1 << 17,
+};
+
+typedef bool (*store_join_fn_t) (
+        const struct rill_store *, enum rill_col, size_t key_idx,
+        const uint8_t *list, void *ctx);
+
+// Coalesces the lists of batch starting at i into a single range of the file
+// and returns the index of the first list past the range.
+static size_t store_join_range(
+        const struct rill_store *store,
+        enum rill_col col,
+        const size_t *batch, size_t len, size_t i,
+        uint64_t *start, uint64_t *end)
+{
+    struct index *index = store->index[col];
+    uint64_t base = store->head->data_off[col];
+
+    *start = base + index->data[batch[i]].off;
+    *end = *start + store_list_len(store, col, batch[i]);
+
+    for (i++; i < len; i++) {
+        uint64_t off = base + index->data[batch[i]].off;
+        if (off > *end + store_join_gap) break;
+
+        uint64_t list_end = off + store_list_len(store, col, batch[i]);
+        if (list_end > *end) *end = list_end;
     }
-    if (!coder_finish(&coder_a)) goto fail_encode_a;
 
-    writer_offsets_finish(&store, coder_off(&coder_a));
-    rill_rows_invert(rows);
+    return i;
+}
 
-    struct encoder coder_b = store_encoder(&store, rill_col_b, vals);
-    for (size_t i = 0; i < rows->len; ++i) {
-        if (!coder_encode(&coder_b, &rows->data[i])) goto fail_encode_b;
+static bool store_pread_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        const size_t *batch, size_t len,
+        store_join_fn_t fn, void *ctx);
+
+static bool store_join_flush(
+        const struct rill_store *store,
+        enum rill_col col,
+        const size_t *batch, size_t len,
+        store_join_fn_t fn, void *ctx)
+{
+    if (store->flags & rill_store_pread)
+        return store_pread_join(store, col, batch, len, fn, ctx);
+
+    // A few lists aren't worth the syscalls.
+    if (len >= store_join_ahead) {
+        uint64_t start = 0, end = 0;
+        for (size_t i = 0; i < len;) {
+            i = store_join_range(store, col, batch, len, i, &start, &end);
+            store_madvise(store, start, end, MADV_WILLNEED);
+        }
     }
-    if (!coder_finish(&coder_b)) goto fail_encode_b;
 
-    store.head->rows = rows->len;
-    writer_close(&store, store.head->data_off[rill_col_b] + coder_off(&coder_b));
+    struct index *index = store->index[col];
+    const uint8_t *data = store->vma + store->head->data_off[col];
 
-    coder_close(&coder_a);
-    coder_close(&coder_b);
+    for (size_t i = 0; i < len && i < store_join_ahead; ++i)
+        __builtin_prefetch(data + index->data[batch[i]].off);
+
+    for (size_t i = 0; i < len; ++i) {
+        if (i + store_join_ahead < len)
+            __builtin_prefetch(data + index->data[batch[i + store_join_ahead]].off);
+
+        const uint8_t *list = data + index->data[batch[i]].off;
+        if (!fn(store, col, batch[i], list, ctx)) return false;
+    }
+
+    return true;
+}
+
+// Merge-join of the sorted keys against the index: every key resumes the search
+// where the previous one left off.
+static bool store_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        store_join_fn_t fn, void *ctx)
+{
+    struct index *index = store->index[col];
+    if (!len || !index->len) return true;
+    if (keys[len - 1] < index->data[0].key) return true;
+    if (keys[0] > index->data[index->len - 1].key) return true;
+
+    struct filter *filter = store->filter[col];
+
+    size_t pos = 0;
+    size_t batch_len = 0;
+    size_t batch[store_join_window];
+
+    for (size_t i = 0; i < len; ++i) {
+        if (filter && !filter_test(filter, keys[i])) continue;
+
+        pos = index_lower_bound(index, keys[i], pos);
+        if (pos == index->len) break;
+        if (index->data[pos].key != keys[i]) continue;
+
+        batch[batch_len++] = pos;
+
+        if (batch_len == store_join_window) {
+            if (!store_join_flush(store, col, batch, batch_len, fn, ctx))
+                return false;
+            batch_len = 0;
+        }
+    }
+
+    return store_join_flush(store, col, batch, batch_len, fn, ctx);
+}
+
+static bool store_query_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        const uint8_t *list,
+        void *ctx)
+{
+    return store_query_list(store, col, key_idx, list, ctx);
+}
+
+bool rill_store_query_keys(
+        const struct rill_store *store,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_rows *out)
+{
+    if (store->flags & rill_store_pread)
+        return store_join(store, col, keys, len, store_query_join, out);
+
+    if (!store_pin(store)) return false;
+    bool ok = store_join(store, col, keys, len, store_query_join, out);
+    store_unpin(store);
+    return ok;
+}
+
+
+static size_t store_count_at(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        uint64_t off)
+{
+    const uint8_t *it = store->vma + store->head->data_off[col] + off;
+    return coder_count(it, it + store_list_len(store, col, key_idx));
+}
+
+static bool store_pread_count(
+        const struct rill_store *store, enum rill_col col, rill_val_t key, size_t *out);
+
+bool rill_store_count(
+        const struct rill_store *store, enum rill_col col, rill_val_t key, size_t *out)
+{
+    *out = 0;
+    if (store_skip(store, col, key)) return true;
+    if (store->flags & rill_store_pread) return store_pread_count(store, col, key, out);
+    if (!store_pin(store)) return false;
+
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    if (store_index_find(store, col, key, &key_idx, &off))
+        *out = store_count_at(store, col, key_idx, off);
+
+    store_unpin(store);
+    return true;
+}
+
+static bool store_contains(const struct rill_store *store, rill_val_t a, rill_val_t b)
+{
+    rill_val_t key[rill_cols] = { [rill_col_a] = a, [rill_col_b] = b };
+    size_t idx[rill_cols] = {0};
+    uint64_t off[rill_cols] = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        if (!store_index_find(store, col, key[col], &idx[col], &off[col]))
+            return false;
+    }
+
+    // Either list will do so might as well scan the shortest one. Values in a
+    // list are ordinals in the index of the other column offset by one.
+    enum rill_col col =
+        store_list_len(store, rill_col_a, idx[rill_col_a]) <=
+        store_list_len(store, rill_col_b, idx[rill_col_b]) ?
+        rill_col_a : rill_col_b;
+
+    struct decoder coder = store_decoder_at(store, col, idx[col], off[col]);
+    return coder_contains(&coder, idx[rill_col_flip(col)] + 1);
+}
+
+bool rill_store_contains(
+        const struct rill_store *store, rill_val_t a, rill_val_t b, bool *out)
+{
+    *out = false;
+    if (store_skip(store, rill_col_a, a) || store_skip(store, rill_col_b, b))
+        return true;
+    if (!store_pin(store)) return false;
+
+    *out = store_contains(store, a, b);
+    store_unpin(store);
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// pread
+// -----------------------------------------------------------------------------
+
+// Stores opened with rill_store_pread read their lookup sections in memory on
+// open and serve key lookups by reading the lists they need into buffers
+// rather than faulting in the mapping. IO errors are reported instead of
+// killing the process with a SIGBUS and the number of reads in flight is
+// bounded by the number of threads issuing lookups. Everything else goes
+// through the mapping of the lazy store underneath.
+//
+// Lookups on a window of lists first hint the kernel with the coalesced
+// ranges they're about to read so that the reads overlap. The buffers are
+// recycled through a process-wide free list which only keeps the smaller
+// ones around.
+
+struct store_buf
+{
+    struct store_buf *next;
+    size_t cap;
+    uint8_t data[];
+};
+
+enum
+{
+    store_buf_min = 1 << 16,
+    store_buf_keep = 1 << 22,
+    store_bufs_cap = 64,
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    size_t len;
+    struct store_buf *free;
+} store_bufs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct store_buf *store_buf_get(size_t len)
+{
+    pthread_mutex_lock(&store_bufs.lock);
+
+    struct store_buf **it = &store_bufs.free;
+    while (*it && (*it)->cap < len) it = &(*it)->next;
+
+    struct store_buf *buf = *it;
+    if (buf) {
+        *it = buf->next;
+        store_bufs.len--;
+    }
+
+    pthread_mutex_unlock(&store_bufs.lock);
+    if (buf) return buf;
+
+    size_t cap = len < store_buf_min ? store_buf_min : len;
+    buf = malloc(sizeof(*buf) + cap);
+    if (!buf) {
+        rill_fail("unable to allocate read buffer: %lu", cap);
+        return NULL;
+    }
+
+    buf->cap = cap;
+    return buf;
+}
+
+static void store_buf_put(struct store_buf *buf)
+{
+    pthread_mutex_lock(&store_bufs.lock);
+
+    if (buf->cap <= store_buf_keep && store_bufs.len < store_bufs_cap) {
+        buf->next = store_bufs.free;
+        store_bufs.free = buf;
+        store_bufs.len++;
+        buf = NULL;
+    }
+
+    pthread_mutex_unlock(&store_bufs.lock);
+    free(buf);
+}
+
+static bool store_pread(
+        const struct rill_store *store, uint8_t *dst, size_t len, uint64_t off)
+{
+    while (len) {
+        ssize_t ret = pread(store->fd, dst, len, off);
+        if (ret == -1 && errno == EINTR) continue;
+
+        if (ret == -1) {
+            rill_fail_errno("unable to read '%s' at '%lu'", store->file, off);
+            return false;
+        }
+
+        if (!ret) {
+            rill_fail("unexpected end of file for '%s' at '%lu'", store->file, off);
+            return false;
+        }
+
+        dst += ret;
+        len -= ret;
+        off += ret;
+    }
+
+    return true;
+}
+
+static bool store_pread_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        const size_t *batch, size_t len,
+        store_join_fn_t fn, void *ctx)
+{
+    uint64_t start = 0, end = 0;
+
+    if (len > 1) {
+        for (size_t i = 0; i < len;) {
+            i = store_join_range(store, col, batch, len, i, &start, &end);
+            (void) posix_fadvise(store->fd, start, end - start, POSIX_FADV_WILLNEED);
+        }
+    }
+
+    struct index *index = store->index[col];
+    uint64_t base = store->head->data_off[col];
+
+    for (size_t i = 0; i < len;) {
+        size_t first = i;
+        i = store_join_range(store, col, batch, len, i, &start, &end);
+
+        struct store_buf *buf = store_buf_get(end - start);
+        if (!buf) return false;
+
+        bool ok = store_pread(store, buf->data, end - start, start);
+        for (size_t j = first; ok && j < i; ++j) {
+            const uint8_t *list = buf->data + (base + index->data[batch[j]].off - start);
+            ok = fn(store, col, batch[j], list, ctx);
+        }
+
+        store_buf_put(buf);
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+static bool store_pread_query(
+        const struct rill_store *store, enum rill_col col, rill_val_t key,
+        struct rill_rows *out)
+{
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    if (!store_index_find(store, col, key, &key_idx, &off)) return true;
+
+    return store_pread_join(store, col, &key_idx, 1, store_query_join, out);
+}
+
+static bool store_count_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        const uint8_t *list,
+        void *ctx)
+{
+    size_t *count = ctx;
+    *count = coder_count(list, list + store_list_len(store, col, key_idx));
+    return true;
+}
+
+static bool store_pread_count(
+        const struct rill_store *store, enum rill_col col, rill_val_t key, size_t *out)
+{
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    if (!store_index_find(store, col, key, &key_idx, &off)) return true;
+
+    return store_pread_join(store, col, &key_idx, 1, store_count_join, out);
+}
+
+
+// -----------------------------------------------------------------------------
+// top
+// -----------------------------------------------------------------------------
+
+// Keys are visited in increasing order so on ties the earlier key wins.
+static inline bool top_worse(
+        const struct rill_key_count *lhs, const struct rill_key_count *rhs)
+{
+    if (lhs->count != rhs->count) return lhs->count < rhs->count;
+    return lhs->key > rhs->key;
+}
+
+static void top_sift(struct rill_key_count *heap, size_t len, size_t i)
+{
+    while (true) {
+        size_t min = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < len && top_worse(&heap[left], &heap[min])) min = left;
+        if (right < len && top_worse(&heap[right], &heap[min])) min = right;
+        if (min == i) return;
+
+        struct rill_key_count tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static int top_cmp(const void *l, const void *r)
+{
+    const struct rill_key_count *lhs = l, *rhs = r;
+    if (top_worse(lhs, rhs)) return +1;
+    if (top_worse(rhs, lhs)) return -1;
+    return 0;
+}
+
+// Bounded min-heap over the counts of the keys. Every value takes at least a
+// byte so the length of a list in bytes bounds its count which lets us skip
+// counting most of the lists once the heap is full.
+bool rill_store_top_keys(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t k,
+        struct rill_key_count *out,
+        size_t *len)
+{
+    *len = 0;
+    if (!k) return true;
+    if (!store_pin(store)) return false;
+
+    struct index *index = store->index[col];
+
+    for (size_t i = 0; i < index->len; ++i) {
+        if (*len == k && store_list_len(store, col, i) <= out[0].count) continue;
+
+        struct rill_key_count item = {
+            .key = index->data[i].key,
+            .count = store_count_at(store, col, i, index->data[i].off),
+        };
+
+        if (*len < k) {
+            out[(*len)++] = item;
+            if (*len == k) {
+                for (size_t j = k; j > 0; --j) top_sift(out, k, j - 1);
+            }
+        }
+        else if (top_worse(&out[0], &item)) {
+            out[0] = item;
+            top_sift(out, k, 0);
+        }
+    }
+
+    qsort(out, *len, sizeof(out[0]), top_cmp);
+    store_unpin(store);
+    return true;
+}
 
-    for (size_t col = 0; col < rill_cols; ++col)
-        free(vals[col]);
 
-    return true;
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
 
-  fail_encode_b:
-    coder_close(&coder_b);
-  fail_encode_a:
-    coder_close(&coder_a);
-    writer_close(&store, 0);
-  fail_open:
-    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
-  fail_vals:
-    return false;
-}
+struct store_ords
+{
+    uint64_t *data;
+    size_t len;
+};
 
+static int store_ords_cmp(const void *l, const void *r)
+{
+    const struct store_ords *lhs = l, *rhs = r;
+    if (lhs->len < rhs->len) return -1;
+    if (lhs->len > rhs->len) return +1;
+    return 0;
+}
 
-static bool store_merge_col(
-        struct rill_store** list,
-        size_t list_len,
+// Operations are carried out on the ordinals of the lists which avoids going
+// through the lookup for values that don't make it to the result. Ordinals
+// share the order of their values so the result can be translated as is.
+static bool store_set(
+        const struct rill_store *store,
         enum rill_col col,
-        struct encoder* coder)
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
 {
-    struct rill_row rows[list_len];
-    struct decoder decoders[list_len];
+    if (!len) return true;
+
+    uint64_t *buffer = NULL;
+    struct store_ords *lists = calloc(len, sizeof(*lists));
+    size_t *offs = calloc(len * 2, sizeof(*offs));
+    if (!lists || !offs) {
+        rill_fail("unable to allocate set lists: %lu", len);
+        goto fail;
+    }
 
-    size_t it_len = 0;
-    for (size_t i = 0; i < list_len; ++i) {
-        if (!list[i]) continue;
-        decoders[it_len] = store_decoder(list[i], col);
-        it_len++;
+    size_t *key_idx = offs + len, total = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (!store_index_find(store, col, keys[i], &key_idx[i], &offs[i])) continue;
+
+        lists[i].len = store_count_at(store, col, key_idx[i], offs[i]);
+        total += lists[i].len;
     }
-    assert(it_len);
 
-    for (size_t i = 0; i < it_len; ++i) {
-        if (!(coder_decode(&decoders[i], &rows[i]))) goto fail_decoder;
+    // Union needs two more buffers to merge back and forth between.
+    buffer = calloc(total * 3 + 1, sizeof(*buffer));
+    if (!buffer) {
+        rill_fail("unable to allocate ordinals: %lu", total);
+        goto fail;
     }
 
-    struct rill_row prev = {0};
-    while (it_len > 0) {
-        size_t target = 0;
+    uint64_t *it = buffer;
+    for (size_t i = 0; i < len; ++i) {
+        if (!lists[i].len) continue;
 
-        for (size_t i = 1; i < it_len; ++i) {
-            if (rill_row_cmp(&rows[i], &rows[target]) < 0)
-                target = i;
-        }
+        struct decoder coder = store_decoder_at(store, col, key_idx[i], offs[i]);
+        size_t cap = lists[i].len;
+        if (!coder_decode_ords(&coder, it, cap, &lists[i].len)) goto fail;
 
-        struct rill_row *row = &rows[target];
-        struct decoder *decoder = &decoders[target];
+        lists[i].data = it;
+        it += cap;
+    }
 
-        if (rill_likely(rill_row_nil(&prev) || rill_row_cmp(&prev, row) < 0)) {
-            if (!coder_encode(coder, row)) goto fail_decoder;
-            prev = *row;
-        }
+    struct store_ords result = lists[0];
 
-        if (!coder_decode(decoder, row)) goto fail_decoder;
-        if (rill_unlikely(rill_row_nil(row))) {
-            memmove(rows + target,
-                    rows + target + 1,
-                    (it_len - target - 1) * sizeof(rows[0]));
-            memmove(decoders + target,
-                    decoders + target + 1,
-                    (it_len - target - 1) * sizeof(decoders[0]));
-            it_len--;
+    switch (op) {
+
+    case rill_set_union:
+        for (size_t i = 1; i < len; ++i) {
+            uint64_t *merged = it + (i % 2) * total;
+            result.len = set_union(
+                    result.data, result.len, lists[i].data, lists[i].len, merged);
+            result.data = merged;
         }
+        break;
+
+    case rill_set_intersect:
+        // Starting from the shortest list keeps the intermediate results small
+        // and lets the galloping skip through the longer lists.
+        qsort(lists, len, sizeof(lists[0]), store_ords_cmp);
+        result = lists[0];
+
+        for (size_t i = 1; result.len && i < len; ++i)
+            result.len = set_intersect(
+                    result.data, result.len, lists[i].data, lists[i].len, result.data);
+        break;
+
+    case rill_set_diff:
+        for (size_t i = 1; result.len && i < len; ++i)
+            result.len = set_diff(
+                    result.data, result.len, lists[i].data, lists[i].len, result.data);
+        break;
+
+    default:
+        rill_fail("unknown set operation: %d", op);
+        goto fail;
     }
 
+    if (!rill_vals_reserve(out, out->len + result.len)) goto fail;
+
+    struct index *lookup = store->index[rill_col_flip(col)];
+    for (size_t i = 0; i < result.len; ++i)
+        out->data[out->len++] = lookup->data[result.data[i] - 1].key;
+
+    free(buffer);
+    free(offs);
+    free(lists);
     return true;
 
-  fail_decoder:
+  fail:
+    free(buffer);
+    free(offs);
+    free(lists);
     return false;
 }
 
-bool rill_store_merge(
-        const char *file,
-        rill_ts_t ts, size_t quant,
-        struct rill_store **list, size_t list_len)
+bool rill_store_set(
+        const struct rill_store *store,
+        enum rill_col col,
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
 {
-    assert(list_len > 1);
+    if (!store_pin(store)) return false;
 
-    size_t rows = 0;
-    struct vals *vals[rill_cols] = {0};
+    bool ok = store_set(store, col, op, keys, len, out);
+    store_unpin(store);
+    return ok;
+}
 
-    for (size_t i = 0; i < list_len; ++i) {
-        if (!list[i]) continue;
 
-        for (size_t col = 0; col < rill_cols; ++col) {
-            struct vals *ret = vals_add_index(vals[col], list[i]->index[col]);
-            if (!ret) goto fail_vals;
-            vals[col] = ret;
-        }
+// -----------------------------------------------------------------------------
+// expand
+// -----------------------------------------------------------------------------
 
-        rows += list[i]->head->rows;
-    }
+// Marks the ordinals of the list in a bitmap over the other column's index.
+static bool store_expand_join(
+        const struct rill_store *store,
+        enum rill_col col,
+        size_t key_idx,
+        const uint8_t *list,
+        void *ctx)
+{
+    uint64_t *bitmap = ctx;
 
-    struct rill_store store = {0};
-    if (!writer_open(&store, file, vals, rows, ts, quant)) goto fail_open;
+    enum { cap = 256 };
+    uint64_t ords[cap];
+    size_t len = cap;
 
-    writer_offsets_init(&store, vals);
+    struct decoder coder = store_list_decoder(store, col, key_idx, list);
+    while (len == cap) {
+        if (!coder_decode_ords(&coder, ords, cap, &len)) return false;
 
-    struct encoder encoder_a = store_encoder(&store, rill_col_a, vals);
-    if (!store_merge_col(list, list_len, rill_col_a, &encoder_a)) goto fail_coder_a;
-    if (!coder_finish(&encoder_a)) goto fail_coder_a;
+        for (size_t i = 0; i < len; ++i)
+            bitmap[ords[i] / 64] |= 1UL << (ords[i] % 64);
+    }
 
-    writer_offsets_finish(&store, coder_off(&encoder_a));
+    return true;
+}
 
-    struct encoder encoder_b = store_encoder(&store, rill_col_b, vals);
-    if (!store_merge_col(list, list_len, rill_col_b, &encoder_b)) goto fail_coder_b;
-    if (!coder_finish(&encoder_b)) goto fail_coder_b;
+// Lists that share values would need to be merged together in the value domain
+// so instead the ordinals are deduped in a bitmap which also comes out sorted.
+static bool store_expand(
+        const struct rill_store *store,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
+{
+    struct index *lookup = store->index[rill_col_flip(col)];
 
-    store.head->rows = encoder_a.rows;
-    writer_close(&store, store.head->data_off[rill_col_b] + coder_off(&encoder_b));
+    size_t words = lookup->len / 64 + 1;
+    uint64_t *bitmap = calloc(words, sizeof(*bitmap));
+    if (!bitmap) {
+        rill_fail("unable to allocate bitmap: %lu", lookup->len);
+        return false;
+    }
 
-    coder_close(&encoder_a);
-    coder_close(&encoder_b);
+    if (!store_join(store, col, keys, len, store_expand_join, bitmap)) goto fail;
 
-    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
+    size_t count = 0;
+    for (size_t i = 0; i < words; ++i) count += __builtin_popcountl(bitmap[i]);
+    if (!rill_vals_reserve(out, out->len + count)) goto fail;
+
+    for (size_t i = 0; i < words; ++i) {
+        for (uint64_t word = bitmap[i]; word; word &= word - 1) {
+            size_t ord = i * 64 + __builtin_ctzl(word);
+            out->data[out->len++] = lookup->data[ord - 1].key;
+        }
+    }
+
+    free(bitmap);
     return true;
 
-    coder_close(&encoder_b);
-  fail_coder_b:
-    coder_close(&encoder_a);
-  fail_coder_a:
-    writer_close(&store, 0);
-  fail_open:
-  fail_vals:
-    for (size_t col = 0; col < rill_cols; ++col) free(vals[col]);
+  fail:
+    free(bitmap);
     return false;
 }
 
+bool rill_store_expand(
+        const struct rill_store *store,
+        enum rill_col col,
+        const rill_val_t *keys, size_t len,
+        struct rill_vals *out)
+{
+    if (!store_pin(store)) return false;
+    bool ok = store_expand(store, col, keys, len, out);
+    store_unpin(store);
+    return ok;
+}
+
 
 // -----------------------------------------------------------------------------
-// header info
+// sketch
 // -----------------------------------------------------------------------------
 
-const char * rill_store_file(const struct rill_store *store)
-{
-    return store->file;
-}
+static_assert((size_t) rill_sketch_regs == (size_t) hll_regs, "mismatched sketch registers");
 
-unsigned rill_store_version(const struct rill_store *store)
+double rill_sketch_estimate(const struct rill_sketch *sketch)
 {
-    return store->head->version;
+    return hll_estimate(sketch->regs);
 }
 
-rill_ts_t rill_store_ts(const struct rill_store *store)
+static bool store_sketch(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_sketch *out)
 {
-    return store->head->ts;
-}
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    if (!store_index_find(store, col, key, &key_idx, &off)) return true;
 
-size_t rill_store_quant(const struct rill_store *store)
-{
-    return store->head->quant;
+    if (store->hll[col]) {
+        uint8_t *regs = hll_find(store->hll[col], key_idx);
+        if (regs) {
+            hll_union(out->regs, regs);
+            return true;
+        }
+    }
+
+    struct rill_row row = {0};
+    struct decoder coder = store_decoder_at(store, col, key_idx, off);
+
+    while (true) {
+        if (!coder_decode(&coder, &row)) return false;
+        if (rill_row_nil(&row) || row.a != key) break;
+        hll_add(out->regs, row.b);
+    }
+
+    return true;
 }
 
-size_t rill_store_rows(const struct rill_store *store)
+bool rill_store_sketch(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t key,
+        struct rill_sketch *out)
 {
-    return store->head->rows;
+    if (store_skip(store, col, key)) return true;
+    if (!store_pin(store)) return false;
+
+    bool ok = store_sketch(store, col, key, out);
+    store_unpin(store);
+    return ok;
 }
 
 
 // -----------------------------------------------------------------------------
-// query
+// minhash
 // -----------------------------------------------------------------------------
 
-size_t rill_store_vals_count(const struct rill_store *store, enum rill_col col)
+static_assert((size_t) rill_minhash_len == (size_t) minhash_hashes, "mismatched minhash length");
+
+void rill_minhash_reset(struct rill_minhash *sig)
 {
-    return store->index[col]->len;
+    minhash_reset(sig->mins);
 }
 
-size_t rill_store_vals(
-        const struct rill_store *store,
-        enum rill_col col,
-        rill_val_t *out,
-        size_t cap)
+double rill_minhash_jaccard(
+        const struct rill_minhash *lhs, const struct rill_minhash *rhs)
 {
-    const struct index* index = store->index[col];
-    size_t len = cap < index->len ? cap : index->len;
-
-    for (size_t i = 0; i < len; ++i)
-        out[i] = index->data[i].key;
+    size_t equal = 0, empty = 0;
+    for (size_t i = 0; i < minhash_hashes; ++i) {
+        equal += lhs->mins[i] == rhs->mins[i];
+        empty += lhs->mins[i] == UINT32_MAX;
+    }
 
-    return len;
+    if (empty == minhash_hashes) return 0;
+    return (double) equal / minhash_hashes;
 }
 
-
-bool rill_store_query(
-        const struct rill_store *store,
-        enum rill_col col,
-        rill_val_t key,
-        struct rill_rows *out)
+static bool store_minhash(
+        const struct rill_store *store, rill_val_t key, struct rill_minhash *out)
 {
     uint64_t off = 0;
     size_t key_idx = 0;
-    if (!index_find(store->index[col], key, &key_idx, &off)) return true;
+    if (!store_index_find(store, rill_col_a, key, &key_idx, &off)) return true;
 
-    struct rill_row row = {0};
-    struct decoder coder = store_decoder_at(store, col, key_idx, off);
+    if (store->minhash) {
+        uint32_t *sig = minhash_find(store->minhash, key_idx);
+        if (sig) {
+            minhash_union(out->mins, sig);
+            return true;
+        }
+    }
 
-    while (true) {
-        if (!coder_decode(&coder, &row)) return false;
-        if (rill_row_nil(&row) || row.a != key) break;
+    return store_minhash_at(store, key_idx, off, out->mins);
+}
+
+bool rill_store_minhash(
+        const struct rill_store *store, rill_val_t key, struct rill_minhash *out)
+{
+    if (store_skip(store, rill_col_a, key)) return true;
+    if (!store_pin(store)) return false;
+
+    bool ok = store_minhash(store, key, out);
+    store_unpin(store);
+    return ok;
+}
+
+// Candidates are found using the signature of the key within the store as it's
+// what the signatures of the other keys in the store are comparable to.
+static bool store_similar(
+        const struct rill_store *store, rill_val_t key, struct rill_vals *out)
+{
+    struct minhash *minhash = store->minhash;
+    if (!minhash) return true;
+
+    struct rill_minhash sig = {0};
+    rill_minhash_reset(&sig);
+    if (!store_minhash(store, key, &sig)) return false;
+    if (sig.mins[0] == UINT32_MAX) return true; // absent or empty key.
+
+    struct index *index = store->index[rill_col_a];
+
+    for (size_t band = 0; band < minhash_bands; ++band) {
+        size_t len = 0;
+        uint64_t hash = minhash_band_hash(sig.mins, band);
+        struct minhash_entry *bucket = minhash_bucket(minhash, band, hash, &len);
 
-        if (!rill_rows_push(out, row.a, row.b)) return false;
+        for (size_t i = 0; i < len; ++i) {
+            size_t key_idx = minhash->keys[bucket[i].idx];
+            if (!rill_vals_push(out, index->data[key_idx].key)) return false;
+        }
     }
 
     return true;
 }
 
+bool rill_store_similar(
+        const struct rill_store *store, rill_val_t key, struct rill_vals *out)
+{
+    if (store->head->version < 10 || !store->head->minhash_off) return true;
+    if (store_skip(store, rill_col_a, key)) return true;
+    if (!store_pin(store)) return false;
+
+    bool ok = store_similar(store, key, out);
+    store_unpin(store);
+    return ok;
+}
+
 
 // -----------------------------------------------------------------------------
 // iterators
 // -----------------------------------------------------------------------------
 
-struct rill_store_it { struct decoder decoder; };
+struct rill_store_it
+{
+    const struct rill_store *store; // pinned until the iterator is freed.
+    struct decoder decoder;
+    uint64_t dropped;
+
+    rill_val_t end; // 0 iterates to the end of the column.
+    bool done;
+};
+
+static void store_it_start(struct rill_store_it *it, struct decoder decoder)
+{
+    it->decoder = decoder;
+    it->dropped = decoder.it - (const uint8_t *) it->store->vma;
+}
 
 struct rill_store_it *rill_store_begin(
         const struct rill_store *store, enum rill_col col)
@@ -614,18 +2318,114 @@ struct rill_store_it *rill_store_begin(
     struct rill_store_it *it = calloc(1, sizeof(*it));
     if (!it) return NULL;
 
-    it->decoder = store_decoder(store, col);
+    if (!store_pin(store)) {
+        free(it);
+        return NULL;
+    }
+
+    it->store = store;
+    store_it_start(it, store_decoder(store, col));
+    return it;
+}
+
+struct rill_store_it *rill_store_begin_key(
+        const struct rill_store *store, enum rill_col col, rill_val_t key)
+{
+    struct rill_store_it *it = calloc(1, sizeof(*it));
+    if (!it) {
+        rill_fail("unable to allocate iterator for '%s'", store->file);
+        return NULL;
+    }
+
+    it->end = key + 1;
+    it->done = true;
+    if (store_skip(store, col, key)) return it;
+
+    if (!store_pin(store)) {
+        free(it);
+        return NULL;
+    }
+    it->store = store;
+
+    uint64_t off = 0;
+    size_t key_idx = 0;
+    if (store_index_find(store, col, key, &key_idx, &off)) {
+        store_it_start(it, store_decoder_at(store, col, key_idx, off));
+        it->done = false;
+    }
+
+    return it;
+}
+
+struct rill_store_it *rill_store_begin_range(
+        const struct rill_store *store,
+        enum rill_col col,
+        rill_val_t from, rill_val_t to)
+{
+    if (from + 1 == to) return rill_store_begin_key(store, col, from);
+
+    struct rill_store_it *it = calloc(1, sizeof(*it));
+    if (!it) {
+        rill_fail("unable to allocate iterator for '%s'", store->file);
+        return NULL;
+    }
+
+    it->end = to;
+
+    if (!store_pin(store)) {
+        free(it);
+        return NULL;
+    }
+    it->store = store;
+
+    struct index *index = store->index[col];
+    size_t key_idx = index_lower_bound(index, from, 0);
+
+    if (key_idx < index->len && (!to || index->data[key_idx].key < to)) {
+        uint64_t off = index->data[key_idx].off;
+        store_it_start(it, store_decoder_at(store, col, key_idx, off));
+    }
+    else it->done = true;
+
     return it;
 }
 
 void rill_store_it_free(struct rill_store_it *it)
 {
+    if (it->store) store_unpin(it->store);
     free(it);
 }
 
 bool rill_store_it_next(struct rill_store_it *it, struct rill_row *row)
 {
-    return coder_decode(&it->decoder, row);
+    if (rill_unlikely(it->done)) {
+        *row = (struct rill_row) {0};
+        return true;
+    }
+
+    if (!coder_decode(&it->decoder, row)) return false;
+
+    if (it->end && row->a >= it->end) {
+        *row = (struct rill_row) {0};
+        it->done = true;
+    }
+
+    bool done = it->done || rill_row_nil(row);
+    store_drop_behind(it->store, &it->dropped, it->decoder.it, done);
+    return true;
+}
+
+bool rill_store_it_next_batch(
+        struct rill_store_it *it, struct rill_row *rows, size_t cap, size_t *len)
+{
+    *len = 0;
+    if (rill_unlikely(it->done)) return true;
+
+    if (!coder_decode_batch(&it->decoder, it->end, rows, cap, len)) return false;
+    if (*len < cap) it->done = true;
+
+    store_drop_behind(it->store, &it->dropped, it->decoder.it, it->done);
+    return true;
 }
 
 
@@ -633,20 +2433,43 @@ bool rill_store_it_next(struct rill_store_it *it, struct rill_row *row)
 // stats
 // -----------------------------------------------------------------------------
 
-void rill_store_stats(
+bool rill_store_stats(
         const struct rill_store *store, struct rill_store_stats *out)
 {
+    *out = (struct rill_store_stats) {0};
+    if (!store_pin(store)) return false;
+
     *out = (struct rill_store_stats) {
-        .header_bytes = sizeof(*store->head),
+        .header_bytes = store->head->index_off[rill_col_a],
+
+        .index_bytes[rill_col_a] = index_cap(store->index[rill_col_a]->len),
+        .index_bytes[rill_col_b] = index_cap(store->index[rill_col_b]->len),
+
+        .mph_bytes[rill_col_a] = store->mph[rill_col_a] ?
+            mph_cap(store->mph[rill_col_a]->len) : 0,
+        .mph_bytes[rill_col_b] = store->mph[rill_col_b] ?
+            mph_cap(store->mph[rill_col_b]->len) : 0,
+
+        .filter_bytes[rill_col_a] = store->filter[rill_col_a] ?
+            filter_cap(store->index[rill_col_a]->len) : 0,
+        .filter_bytes[rill_col_b] = store->filter[rill_col_b] ?
+            filter_cap(store->index[rill_col_b]->len) : 0,
 
-        .index_bytes[rill_col_a] = store->head->index_off[rill_col_b] -
-                                   store->head->index_off[rill_col_a],
-        .index_bytes[rill_col_b] = store->head->data_off[rill_col_a] -
-                                   store->head->index_off[rill_col_b],
+        .hll_bytes[rill_col_a] = store->hll[rill_col_a] ?
+            hll_len(store->hll[rill_col_a]) : 0,
+        .hll_bytes[rill_col_b] = store->hll[rill_col_b] ?
+            hll_len(store->hll[rill_col_b]) : 0,
+
+        .minhash_bytes = store->minhash ? minhash_len(store->minhash) : 0,
 
         .rows_bytes[rill_col_a] = store->head->data_off[rill_col_b] -
                                   store->head->data_off[rill_col_a],
-        .rows_bytes[rill_col_b] = store->vma_len -
+        .rows_bytes[rill_col_b] = store_data_end(store) -
                                   store->head->data_off[rill_col_b],
+
+        .resident_bytes = rill_store_resident_bytes(store),
     };
+
+    store_unpin(store);
+    return true;
 }
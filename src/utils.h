@@ -9,7 +9,9 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 
 // -----------------------------------------------------------------------------
@@ -71,6 +73,13 @@ enum
     expire_secs = months_in_expire * month_secs,
 };
 
+static inline uint64_t nsecs_now(void)
+{
+    struct timespec ts = {0};
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
 
 // -----------------------------------------------------------------------------
 // vma
@@ -270,6 +270,37 @@ bool test_coder(void)
 }
 
 
+// -----------------------------------------------------------------------------
+// count
+// -----------------------------------------------------------------------------
+
+static void check_count(struct rng *rng, size_t len, size_t bits)
+{
+    uint8_t buffer[(len + 2) * 10];
+    memset(buffer, 0xFF, sizeof(buffer));
+
+    uint8_t *it = buffer;
+    for (size_t i = 0; i < len; ++i)
+        it = leb128_encode(it, rng_gen_range(rng, 1, 1UL << bits));
+    *it = 0; // terminator followed by garbage.
+
+    assert(coder_count(buffer, buffer + sizeof(buffer)) == len);
+    assert(coder_count(buffer, it + 1) == len);
+}
+
+bool test_count(void)
+{
+    struct rng rng = rng_make(0);
+
+    for (size_t len = 0; len < 100; ++len) {
+        for (size_t bits = 1; bits < 64; bits += 7)
+            check_count(&rng, len, bits);
+    }
+
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
@@ -282,6 +313,7 @@ int main(int argc, char **argv)
     ret = ret && test_leb128();
     ret = ret && test_vals();
     ret = ret && test_coder();
+    ret = ret && test_count();
 
     return ret ? 0 : 1;
 }
@@ -102,6 +102,45 @@ bool test_index_lookup(void)
     return true;
 }
 
+// -----------------------------------------------------------------------------
+// test_index_lower_bound
+// -----------------------------------------------------------------------------
+
+static void check_lower_bound(struct index *index, rill_val_t key)
+{
+    size_t exp = 0;
+    while (exp < index->len && index->data[exp].key < key) exp++;
+
+    for (size_t start = 0; start <= exp; ++start)
+        assert(index_lower_bound(index, key, start) == exp);
+}
+
+bool test_index_lower_bound(void)
+{
+    struct index *index = index_from_keys(3, 6, 9, 12, 15, 18, 21, 24, 27, 30);
+
+    for (rill_val_t key = 0; key < 35; ++key)
+        check_lower_bound(index, key);
+
+    free(index);
+
+    struct rng rng = rng_make(0);
+    for (size_t len = 1; len < 200; len += 7) {
+        rill_val_t keys[len];
+        keys[0] = rng_gen_range(&rng, 1, 10);
+        for (size_t i = 1; i < len; ++i)
+            keys[i] = keys[i - 1] + rng_gen_range(&rng, 1, 10);
+
+        index = make_index(keys, len);
+        for (rill_val_t key = 0; key < keys[len - 1] + 2; ++key)
+            check_lower_bound(index, key);
+        free(index);
+    }
+
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
@@ -113,6 +152,7 @@ int main(int argc, char **argv)
 
     ret = ret && test_index_build();
     ret = ret && test_index_lookup();
+    ret = ret && test_index_lower_bound();
 
     return ret ? 0 : 1;
 }
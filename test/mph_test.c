@@ -0,0 +1,105 @@
+/* mph_test.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include "mph.c"
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static int key_cmp(const void *l, const void *r)
+{
+    rill_val_t lhs = *((const rill_val_t *) l);
+    rill_val_t rhs = *((const rill_val_t *) r);
+
+    if (lhs < rhs) return -1;
+    if (lhs > rhs) return 1;
+    return 0;
+}
+
+static size_t make_keys(struct rng *rng, rill_val_t *keys, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        keys[i] = rng_gen_range(rng, 1, rng_max());
+
+    qsort(keys, len, sizeof(keys[0]), key_cmp);
+
+    size_t j = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (j && keys[j - 1] == keys[i]) continue;
+        keys[j++] = keys[i];
+    }
+
+    return j;
+}
+
+
+// -----------------------------------------------------------------------------
+// test_mph
+// -----------------------------------------------------------------------------
+
+static void check_mph(struct rng *rng, size_t len)
+{
+    rill_val_t *keys = calloc(len + 1, sizeof(*keys));
+    len = make_keys(rng, keys, len);
+
+    struct mph *mph = calloc(1, mph_cap(len));
+    assert(mph_build(mph, keys, len));
+
+    uint8_t *seen = calloc(len + 1, 1);
+    for (size_t i = 0; i < len; ++i) {
+        size_t idx = 0;
+        assert(mph_find(mph, keys[i], &idx));
+        assert(idx == i);
+        assert(!seen[idx]);
+        seen[idx] = 1;
+    }
+
+    // Absent keys may alias with a fingerprint but should be rare.
+    size_t false_positives = 0;
+    for (size_t i = 0; i < len; ++i) {
+        size_t idx = 0;
+        rill_val_t key = rng_gen_range(rng, 1, rng_max());
+        if (!mph_find(mph, key, &idx)) continue;
+        assert(idx < len);
+        if (keys[idx] != key) false_positives++;
+    }
+    assert(false_positives <= len / 1000 + 1);
+
+    free(seen);
+    free(mph);
+    free(keys);
+}
+
+bool test_mph(void)
+{
+    struct rng rng = rng_make(0);
+
+    for (size_t len = 0; len < 64; ++len)
+        check_mph(&rng, len);
+
+    for (size_t len = 64; len <= 1UL << 20; len *= 4)
+        check_mph(&rng, len + rng_gen_range(&rng, 0, len));
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    (void) argc, (void) argv;
+    bool ret = true;
+
+    ret = ret && test_mph();
+
+    return ret ? 0 : 1;
+}
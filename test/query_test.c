@@ -0,0 +1,1305 @@
+/* query_test.c
+   Rémi Attab (remi.attab@gmail.com), 18 Oct 2026
+   FreeBSD-style copyright and disclaimer apply
+*/
+
+#include "test.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+
+// -----------------------------------------------------------------------------
+// utils
+// -----------------------------------------------------------------------------
+
+static const char *query_dir = "test.query.db";
+
+enum { query_stores = 8 };
+
+// Spreads the rows over multiple stores and returns the expected content of
+// the whole db.
+static struct rill_rows make_db(struct rng *rng)
+{
+    rm(query_dir);
+    mkdir(query_dir, 0775);
+
+    struct rill_rows expected = {0};
+
+    for (size_t i = 0; i < query_stores; ++i) {
+        struct rill_rows rows = make_rng_rows(rng);
+        rill_rows_append(&expected, &rows);
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, i);
+        assert(rill_store_write(file, i * hour_secs, hour_secs, &rows));
+
+        rill_rows_free(&rows);
+    }
+
+    rill_rows_compact(&expected);
+    return expected;
+}
+
+static void check_rows(
+        const struct rill_rows *expected,
+        const rill_val_t *keys, size_t len,
+        const struct rill_rows *result)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < expected->len; ++i) {
+        size_t k = 0;
+        while (k < len && keys[k] != expected->data[i].a) k++;
+        if (k == len) continue;
+
+        assert(j < result->len);
+        assert(!rill_row_cmp(&expected->data[i], &result->data[j]));
+        j++;
+    }
+    assert(j == result->len);
+}
+
+
+// -----------------------------------------------------------------------------
+// key
+// -----------------------------------------------------------------------------
+
+bool test_query_key(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_rows result = {0};
+
+    for (size_t threads = 0; threads <= 4; threads += 4) {
+        assert(rill_query_threads(query, threads));
+
+        for (size_t col = 0; col < rill_cols; ++col) {
+            for (rill_val_t key = 1; key <= rng_range_a; ++key) {
+                rill_rows_clear(&result);
+                assert(rill_query_key(query, col, key, &result));
+                check_rows(&expected, &key, 1, &result);
+            }
+
+            rill_rows_invert(&expected);
+        }
+    }
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// cache
+// -----------------------------------------------------------------------------
+
+bool test_query_cache(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_rows result = {0};
+    struct rill_query_cache_stats stats = {0};
+
+    // Large enough to hold everything: the second pass should only hit.
+    assert(rill_query_cache(query, 1UL << 30));
+
+    for (size_t pass = 0; pass < 2; ++pass) {
+        for (rill_val_t key = 1; key <= rng_range_a + 10; ++key) {
+            rill_rows_clear(&result);
+            assert(rill_query_key(query, rill_col_a, key, &result));
+            check_rows(&expected, &key, 1, &result);
+        }
+    }
+
+    rill_query_cache_stats(query, &stats);
+    assert(stats.misses == rng_range_a + 10);
+    assert(stats.hits == rng_range_a + 10);
+    assert(stats.entries == rng_range_a + 10);
+
+    // Small enough to force evictions.
+    size_t budget = 16 * 1024;
+    assert(rill_query_cache(query, budget));
+
+    for (size_t iterations = 0; iterations < 1000; ++iterations) {
+        rill_val_t key = rng_gen_range(&rng, 1, rng_range_a);
+
+        rill_rows_clear(&result);
+        assert(rill_query_key(query, rill_col_a, key, &result));
+        check_rows(&expected, &key, 1, &result);
+
+        rill_query_cache_stats(query, &stats);
+        assert(stats.bytes <= budget);
+    }
+
+    rill_query_cache_stats(query, &stats);
+    assert(stats.hits && stats.misses);
+    assert(stats.hits + stats.misses == 1000);
+
+    assert(rill_query_cache(query, 0));
+    rill_query_cache_stats(query, &stats);
+    assert(!stats.hits && !stats.misses);
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// refresh
+// -----------------------------------------------------------------------------
+
+static const rill_val_t refresh_val = rng_range_b + 1;
+
+static void refresh_write(const char *file)
+{
+    struct rill_rows rows = make_rows(row(1, refresh_val), row(rng_range_a + 1, 1));
+    assert(rill_store_write(file, query_stores * hour_secs, hour_secs, &rows));
+    rill_rows_free(&rows);
+}
+
+static bool refresh_has_val(struct rill_query *query, rill_val_t key)
+{
+    struct rill_rows result = {0};
+    assert(rill_query_key(query, rill_col_a, key, &result));
+
+    bool found = false;
+    for (size_t i = 0; i < result.len; ++i)
+        found = found || result.data[i].b == refresh_val;
+
+    rill_rows_free(&result);
+    return found;
+}
+
+struct refresh_ctx
+{
+    struct rill_query *query;
+    bool done;
+};
+
+static void *refresh_reader(void *data)
+{
+    struct refresh_ctx *ctx = data;
+
+    while (!__atomic_load_n(&ctx->done, __ATOMIC_RELAXED)) {
+        struct rill_rows result = {0};
+        assert(rill_query_key(ctx->query, rill_col_a, 1, &result));
+        assert(result.len);
+        rill_rows_free(&result);
+    }
+
+    return NULL;
+}
+
+bool test_query_refresh(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+    assert(rill_query_cache(query, 1UL << 20));
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) query_stores);
+
+    // Prime the cache which must then be invalidated by the refresh.
+    assert(!refresh_has_val(query, 1));
+    assert(!refresh_has_val(query, rng_range_a + 1));
+
+    refresh_write(file);
+    assert(!refresh_has_val(query, 1));
+    assert(rill_query_refresh(query));
+    assert(refresh_has_val(query, 1));
+
+    // Iterators hold on to the stores they were opened with.
+    struct rill_query_it *it = rill_query_begin(query, rill_col_a, 1);
+    assert(it);
+
+    unlink(file);
+    assert(rill_query_refresh(query));
+    assert(!refresh_has_val(query, 1));
+
+    bool found = false;
+    struct rill_row row = {0};
+    while (true) {
+        assert(rill_query_it_next(it, &row));
+        if (rill_row_nil(&row)) break;
+        found = found || row.b == refresh_val;
+    }
+    assert(found);
+    rill_query_it_free(it);
+
+    // Unchanged directory.
+    assert(rill_query_refresh(query));
+    {
+        rill_val_t key = 1;
+        struct rill_rows result = {0};
+        assert(rill_query_key(query, rill_col_a, key, &result));
+        check_rows(&expected, &key, 1, &result);
+        rill_rows_free(&result);
+    }
+
+    // Stores come and go while queries are running.
+    struct refresh_ctx ctx = { .query = query };
+    pthread_t reader;
+    assert(!pthread_create(&reader, NULL, refresh_reader, &ctx));
+
+    for (size_t i = 0; i < 100; ++i) {
+        if (i % 2) unlink(file);
+        else refresh_write(file);
+        assert(rill_query_refresh(query));
+    }
+
+    __atomic_store_n(&ctx.done, true, __ATOMIC_RELAXED);
+    assert(!pthread_join(reader, NULL));
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+bool test_query_snapshot(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+    assert(rill_query_threads(query, 4));
+
+    struct rill_query *snapshot = rill_query_snapshot(query);
+    assert(snapshot);
+    assert(!rill_query_refresh(snapshot));
+
+    // The snapshot holds on to the threads it was taken with.
+    assert(rill_query_threads(query, 2));
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) query_stores);
+    refresh_write(file);
+
+    // Same as what rotate does to the inputs of a merge.
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) 0);
+    struct rill_store *store = rill_store_open(file);
+    assert(store);
+    assert(rill_store_rm(store));
+
+    assert(rill_query_refresh(query));
+    assert(refresh_has_val(query, 1));
+    assert(!refresh_has_val(snapshot, 1));
+
+    // Snapshots can outlive their query.
+    rill_query_close(query);
+
+    struct rill_rows result = {0};
+    for (rill_val_t key = 1; key <= rng_range_a; ++key) {
+        rill_rows_clear(&result);
+        assert(rill_query_key(snapshot, rill_col_a, key, &result));
+        check_rows(&expected, &key, 1, &result);
+    }
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(snapshot);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// manifest
+// -----------------------------------------------------------------------------
+
+static size_t manifest_stores(void)
+{
+    size_t len = 0;
+    struct rill_store **list = NULL;
+    assert(rill_open_dir(query_dir, 0, &list, &len, NULL, 0));
+
+    for (size_t i = 0; i < len; ++i) rill_store_close(list[i]);
+    free(list);
+    return len;
+}
+
+struct manifest_ctx
+{
+    bool started;
+    size_t stores;
+};
+
+static void *manifest_reader(void *data)
+{
+    struct manifest_ctx *ctx = data;
+    __atomic_store_n(&ctx->started, true, __ATOMIC_RELEASE);
+    ctx->stores = manifest_stores();
+    return NULL;
+}
+
+bool test_query_manifest(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    assert(manifest_stores() == query_stores);
+
+    // Stores written behind the manifest's back are ignored until a rebuild.
+    assert(rill_manifest_rebuild(query_dir));
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) query_stores);
+    refresh_write(file);
+    assert(manifest_stores() == query_stores);
+
+    assert(rill_manifest_rebuild(query_dir));
+    assert(manifest_stores() == query_stores + 1);
+
+    // Acc flushes are added as they're written.
+    struct rill_acc *acc = rill_acc_open(query_dir, 16);
+    assert(acc);
+    rill_acc_ingest(acc, 1, refresh_val + 1);
+
+    snprintf(file, sizeof(file), "%s/acc.rill", query_dir);
+    assert(rill_acc_write(acc, file, (query_stores + 1) * hour_secs));
+    rill_acc_close(acc);
+    assert(manifest_stores() == query_stores + 2);
+
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_rows result = {0};
+    assert(rill_query_key(query, rill_col_a, 1, &result));
+    assert(result.len && result.data[result.len - 1].b == refresh_val + 1);
+    rill_rows_free(&result);
+    rill_query_close(query);
+
+    // A failed update leaves nothing behind for the retry to duplicate.
+    acc = rill_acc_open(query_dir, 16);
+    assert(acc);
+    rill_acc_ingest(acc, 1, refresh_val + 2);
+
+    char lock[PATH_MAX], pending[PATH_MAX];
+    snprintf(lock, sizeof(lock), "%s/MANIFEST.lock", query_dir);
+    snprintf(file, sizeof(file), "%s/acc-retry.rill", query_dir);
+    snprintf(pending, sizeof(pending), "%s/acc-retry.rill.tmp", query_dir);
+
+    unlink(lock);
+    assert(!mkdir(lock, 0775));
+    assert(!rill_acc_write(acc, file, (query_stores + 2) * hour_secs));
+    assert(access(file, F_OK) == -1 && access(pending, F_OK) == -1);
+
+    assert(!rmdir(lock));
+    assert(rill_acc_write(acc, file, (query_stores + 2) * hour_secs));
+    rill_acc_close(acc);
+    assert(manifest_stores() == query_stores + 3);
+
+    // Listings that race with an update wait for it to complete instead of
+    // skipping the stores it has set aside.
+    {
+        char listed[PATH_MAX], aside[PATH_MAX];
+        snprintf(listed, sizeof(listed), "%s/%010lu.rill", query_dir, (size_t) 0);
+        snprintf(aside, sizeof(aside), "%s/%010lu.rill.rm", query_dir, (size_t) 0);
+
+        int fd = open(lock, O_RDWR);
+        assert(fd != -1);
+        assert(!flock(fd, LOCK_EX));
+        assert(!rename(listed, aside));
+
+        struct manifest_ctx ctx = {0};
+        pthread_t reader;
+        assert(!pthread_create(&reader, NULL, manifest_reader, &ctx));
+        while (!__atomic_load_n(&ctx.started, __ATOMIC_ACQUIRE));
+        usleep(10 * 1000);
+
+        assert(!rename(aside, listed));
+        assert(!flock(fd, LOCK_UN));
+        close(fd);
+
+        assert(!pthread_join(reader, NULL));
+        assert(ctx.stores == query_stores + 3);
+    }
+
+    // Updates interrupted by a crash are finished by the next one: a store set
+    // aside before the manifest was saved is put back, one set aside after is
+    // removed and a published store is renamed into place.
+    char listed[PATH_MAX], aside[PATH_MAX], orphan[PATH_MAX], published[PATH_MAX];
+    snprintf(listed, sizeof(listed), "%s/%010lu.rill", query_dir, (size_t) 0);
+    snprintf(aside, sizeof(aside), "%s/%010lu.rill.rm", query_dir, (size_t) 0);
+    snprintf(orphan, sizeof(orphan), "%s/orphan.rill.rm", query_dir);
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) 1);
+    snprintf(published, sizeof(published), "%s/%010lu.rill.tmp", query_dir, (size_t) 1);
+
+    assert(!rename(listed, aside));
+    assert(!rename(file, published));
+    struct rill_rows rows = make_rows(row(1, 1));
+    assert(rill_store_write(orphan, 0, 0, &rows));
+    rill_rows_free(&rows);
+    assert(manifest_stores() == query_stores + 1);
+
+    assert(rill_manifest_rebuild(query_dir));
+    assert(!access(listed, F_OK) && !access(file, F_OK));
+    assert(access(aside, F_OK) == -1 && access(published, F_OK) == -1);
+    assert(access(orphan, F_OK) == -1);
+    assert(manifest_stores() == query_stores + 3);
+
+    // No longer capped by a fixed size list.
+    for (size_t i = 0; i < 1100; ++i) {
+        struct rill_rows rows = make_rows(row(rng_range_a + 2, i + 1));
+        snprintf(file, sizeof(file), "%s/extra-%04lu.rill", query_dir, i);
+        assert(rill_store_write(file, i, 0, &rows));
+        rill_rows_free(&rows);
+    }
+    assert(rill_manifest_rebuild(query_dir));
+
+    query = rill_query_open(query_dir);
+    assert(query);
+
+    size_t count = 0;
+    rill_val_t key = rng_range_a + 2;
+    assert(rill_query_count(query, rill_col_a, &key, 1, &count));
+    assert(count == 1100);
+    rill_query_close(query);
+
+    // Manifests of the previous version are still readable.
+    snprintf(file, sizeof(file), "%s/MANIFEST", query_dir);
+    FILE *stream = fopen(file, "w");
+    assert(stream);
+    fprintf(stream, "rill-manifest 1\n0 3600 10 1 20 1 20 %010lu.rill\n", (size_t) 0);
+    fclose(stream);
+    assert(manifest_stores() == 1);
+
+    rill_rows_free(&expected);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// open
+// -----------------------------------------------------------------------------
+
+bool test_query_open(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+
+    for (size_t threads = 0; threads <= 4; threads += 4) {
+        size_t len = 0;
+        struct rill_store **list = NULL;
+        struct rill_open_stats stats = {0};
+
+        assert(rill_open_dir_threads(
+                        query_dir, 0, threads, &list, &len, NULL, 0, &stats));
+        assert(len == query_stores);
+        assert(stats.stores == query_stores);
+        assert(stats.wall_ns && stats.open_ns && stats.map_ns);
+
+        // Stores that are already open are reused and don't count as opened.
+        size_t reuse_len = 0;
+        struct rill_store **reuse = NULL;
+        assert(rill_open_dir_threads(
+                        query_dir, 0, threads, &reuse, &reuse_len, list, len, &stats));
+        assert(reuse_len == len);
+        assert(!stats.stores);
+
+        for (size_t i = 0; i < len; ++i) {
+            rill_store_close(list[i]);
+            rill_store_close(reuse[i]);
+        }
+        free(list);
+        free(reuse);
+    }
+
+    struct rill_query *query = rill_query_open_threads(query_dir, 0, 4);
+    assert(query);
+
+    struct rill_open_stats stats = {0};
+    rill_query_open_stats(query, &stats);
+    assert(stats.stores == query_stores);
+
+    struct rill_rows result = {0};
+    for (rill_val_t key = 1; key <= rng_range_a; ++key) {
+        rill_rows_clear(&result);
+        assert(rill_query_key(query, rill_col_a, key, &result));
+        check_rows(&expected, &key, 1, &result);
+    }
+
+    assert(rill_query_refresh(query));
+    rill_query_open_stats(query, &stats);
+    assert(!stats.stores);
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// resident
+// -----------------------------------------------------------------------------
+
+bool test_query_resident(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    size_t len = 0;
+    struct rill_store **list = NULL;
+    assert(rill_open_dir(query_dir, 0, &list, &len, NULL, 0));
+
+    size_t store_bytes = 0;
+    for (size_t i = 0; i < len; ++i) {
+        size_t bytes = rill_store_lookup_bytes(list[i]);
+        if (bytes > store_bytes) store_bytes = bytes;
+        rill_store_close(list[i]);
+    }
+    free(list);
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) query_stores);
+    refresh_write(file);
+
+    struct rill_store *store = rill_store_open(file);
+    assert(store);
+    size_t refresh_bytes = rill_store_lookup_bytes(store);
+    rill_store_close(store);
+    unlink(file);
+
+    // Room for two of the stores and the one added by the refresh.
+    size_t budget = store_bytes * 2 + refresh_bytes;
+    assert(!rill_query_resident_bytes(query));
+    assert(rill_query_resident(query, budget));
+
+    size_t resident = rill_query_resident_bytes(query);
+    assert(resident >= store_bytes && resident <= budget);
+
+    struct rill_rows result = {0};
+    for (rill_val_t key = 1; key <= rng_range_a; ++key) {
+        rill_rows_clear(&result);
+        assert(rill_query_key(query, rill_col_a, key, &result));
+        check_rows(&expected, &key, 1, &result);
+    }
+
+    refresh_write(file);
+    assert(rill_query_refresh(query));
+    assert(rill_query_resident_bytes(query) > resident);
+    assert(rill_query_resident_bytes(query) <= budget);
+    assert(refresh_has_val(query, 1));
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// it
+// -----------------------------------------------------------------------------
+
+bool test_query_it(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        for (size_t i = 0; i < expected.len;) {
+            rill_val_t key = expected.data[i].a;
+            struct rill_query_it *it = rill_query_begin(query, col, key);
+
+            struct rill_row row = {0};
+            for (; i < expected.len && expected.data[i].a == key; ++i) {
+                assert(rill_query_it_next(it, &row));
+                assert(!rill_row_cmp(&expected.data[i], &row));
+            }
+
+            assert(rill_query_it_next(it, &row));
+            assert(rill_row_nil(&row));
+            rill_query_it_free(it);
+        }
+
+        struct rill_query_it *it = rill_query_begin(query, col, -1UL);
+        struct rill_row row = {0};
+        assert(rill_query_it_next(it, &row));
+        assert(rill_row_nil(&row));
+        rill_query_it_free(it);
+
+        rill_rows_invert(&expected);
+    }
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// keys
+// -----------------------------------------------------------------------------
+
+bool test_query_keys(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_rows result = {0};
+
+    for (size_t threads = 0; threads <= 4; threads += 4) {
+        assert(rill_query_threads(query, threads));
+
+        for (size_t col = 0; col < rill_cols; ++col) {
+            for (size_t iterations = 0; iterations < 10; ++iterations) {
+                enum { len = 32 };
+                rill_val_t keys[len];
+                for (size_t i = 0; i < len; ++i)
+                    keys[i] = rng_gen_range(&rng, 0, rng_range_a + 10);
+
+                rill_rows_clear(&result);
+                assert(rill_query_keys(query, col, keys, len, &result));
+                check_rows(&expected, keys, len, &result);
+            }
+
+            rill_rows_invert(&expected);
+        }
+    }
+
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// batch
+// -----------------------------------------------------------------------------
+
+bool test_query_batch(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open_flags(query_dir, rill_store_pread);
+    assert(query);
+
+    // Spans several rounds of the pool.
+    enum { range = rng_range_a + 10, len = 3 * 1024 + 10 };
+    rill_val_t *keys = calloc(len, sizeof(*keys));
+    bool *seen = calloc(len, sizeof(*seen));
+    for (size_t i = 0; i < len; ++i) keys[i] = i % range;
+
+    struct rill_rows result = {0};
+
+    // Second round goes through the cache.
+    for (size_t round = 0; round < 2; ++round) {
+        if (round) assert(rill_query_cache(query, 1UL << 20));
+
+        for (size_t threads = 0; threads <= 4; threads += 4) {
+            assert(rill_query_threads(query, threads));
+
+            for (size_t col = 0; col < rill_cols; ++col) {
+                memset(seen, 0, len * sizeof(*seen));
+                struct rill_query_batch *batch = rill_query_batch(query, col, keys, len);
+                assert(batch);
+
+                for (size_t i = 0; i < len; ++i) {
+                    // Other queries can share the pool with the batch.
+                    rill_val_t other = i % range + 1;
+                    rill_rows_clear(&result);
+                    assert(rill_query_key(query, col, other, &result));
+                    check_rows(&expected, &other, 1, &result);
+
+                    size_t key = len;
+                    rill_rows_clear(&result);
+                    assert(rill_query_batch_next(batch, &key, &result));
+
+                    assert(key < len && !seen[key]);
+                    seen[key] = true;
+                    check_rows(&expected, &keys[key], 1, &result);
+                }
+
+                size_t key = 0;
+                assert(rill_query_batch_next(batch, &key, &result));
+                assert(key == len);
+                rill_query_batch_free(batch);
+
+                rill_rows_invert(&expected);
+            }
+        }
+    }
+
+    // Freeing a batch that wasn't fully reaped cancels the rest.
+    for (size_t threads = 0; threads <= 4; threads += 4) {
+        assert(rill_query_threads(query, threads));
+
+        struct rill_query_batch *batch = rill_query_batch(query, rill_col_a, keys, len);
+        assert(batch);
+
+        size_t key = len;
+        rill_rows_clear(&result);
+        assert(rill_query_batch_next(batch, &key, &result));
+        assert(key < len);
+        rill_query_batch_free(batch);
+    }
+
+    free(seen);
+    free(keys);
+    rill_rows_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// count
+// -----------------------------------------------------------------------------
+
+bool test_query_count(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        for (size_t iterations = 0; iterations < 10; ++iterations) {
+            enum { len = 8 };
+            rill_val_t keys[len];
+            for (size_t i = 0; i < len; ++i)
+                keys[i] = rng_gen_range(&rng, 0, rng_range_a + 10);
+
+            size_t exp = 0;
+            for (size_t i = 0; i < expected.len; ++i) {
+                size_t k = 0;
+                while (k < len && keys[k] != expected.data[i].a) k++;
+                if (k < len) exp++;
+            }
+
+            size_t count = 0;
+            assert(rill_query_count(query, col, keys, len, &count));
+            assert(count == exp);
+        }
+
+        rill_rows_invert(&expected);
+    }
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// range
+// -----------------------------------------------------------------------------
+
+static void check_range(
+        struct rill_query *query, rill_ts_t from, rill_ts_t to,
+        size_t first, size_t last)
+{
+    struct rill_rows result = {0};
+
+    for (rill_val_t key = 1; key <= 4; ++key) {
+        rill_rows_clear(&result);
+        assert(rill_query_key_range(query, rill_col_a, key, from, to, &result));
+
+        assert(result.len == last - first);
+        for (size_t i = 0; i < result.len; ++i) {
+            assert(result.data[i].a == key);
+            assert(result.data[i].b == first + i + 1);
+        }
+    }
+
+    rill_rows_free(&result);
+}
+
+bool test_query_range(void)
+{
+    rm(query_dir);
+    mkdir(query_dir, 0775);
+
+    // Store i covers the ith hour and contains the value i + 1 for all keys.
+    for (size_t i = 0; i < query_stores; ++i) {
+        struct rill_rows rows = {0};
+        for (rill_val_t key = 1; key <= 4; ++key)
+            rill_rows_push(&rows, key, i + 1);
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, i);
+        assert(rill_store_write(file, i * hour_secs + 10, hour_secs, &rows));
+
+        rill_rows_free(&rows);
+    }
+
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    check_range(query, 0, query_stores * hour_secs, 0, query_stores);
+    check_range(query, 2 * hour_secs, 5 * hour_secs, 2, 5);
+    check_range(query, 2 * hour_secs + 30 * min_secs, 3 * hour_secs, 2, 3);
+    check_range(query, 3 * hour_secs - 1, 3 * hour_secs + 1, 2, 4);
+    check_range(query, query_stores * hour_secs, -1UL, 0, 0);
+    check_range(query, 0, 0, 0, 0);
+
+    // Same results through the pool and the cache.
+    assert(rill_query_threads(query, 4));
+    assert(rill_query_cache(query, 1UL << 20));
+    for (size_t round = 0; round < 2; ++round) {
+        check_range(query, 0, query_stores * hour_secs, 0, query_stores);
+        check_range(query, 2 * hour_secs, 5 * hour_secs, 2, 5);
+    }
+
+    // Stores without a quant can hold rows of any time so they're never pruned.
+    {
+        struct rill_rows rows = {0};
+        for (rill_val_t key = 1; key <= 4; ++key)
+            rill_rows_push(&rows, key, query_stores + 1);
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, (size_t) query_stores);
+        assert(rill_store_write(file, 0, 0, &rows));
+        assert(rill_query_refresh(query));
+        rill_rows_free(&rows);
+
+        struct rill_rows result = {0};
+        for (rill_val_t key = 1; key <= 4; ++key) {
+            rill_rows_clear(&result);
+            assert(rill_query_key_range(
+                            query, rill_col_a, key, 5 * hour_secs, 6 * hour_secs, &result));
+
+            assert(result.len == 2);
+            assert(result.data[0].a == key && result.data[0].b == 6);
+            assert(result.data[1].a == key && result.data[1].b == query_stores + 1);
+        }
+        rill_rows_free(&result);
+    }
+
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// contains
+// -----------------------------------------------------------------------------
+
+bool test_query_contains(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    for (size_t i = 0; i < expected.len; ++i) {
+        const struct rill_row *row = &expected.data[i];
+        bool found = false;
+        assert(rill_query_contains(query, row->a, row->b, &found));
+        assert(found);
+        assert(rill_query_contains(query, row->a, row->b + rng_range_b, &found));
+        assert(!found);
+    }
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// scan
+// -----------------------------------------------------------------------------
+
+struct scan_ctx
+{
+    pthread_mutex_t lock;
+    struct rill_rows rows;
+};
+
+static bool scan_fn(void *data, rill_val_t key, const rill_val_t *vals, size_t len)
+{
+    struct scan_ctx *ctx = data;
+    assert(len);
+
+    pthread_mutex_lock(&ctx->lock);
+    for (size_t i = 0; i < len; ++i) {
+        assert(!i || vals[i - 1] < vals[i]);
+        assert(rill_rows_push(&ctx->rows, key, vals[i]));
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return true;
+}
+
+static bool scan_abort_fn(void *data, rill_val_t key, const rill_val_t *vals, size_t len)
+{
+    (void) data, (void) key, (void) vals, (void) len;
+    return false;
+}
+
+bool test_query_scan(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct scan_ctx ctx = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        for (size_t threads = 0; threads <= 4; ++threads) {
+            rill_rows_clear(&ctx.rows);
+            assert(rill_query_scan(query, col, threads, scan_fn, &ctx));
+
+            // keys are never repeated so the rows are unique but the ranges
+            // can complete in any order.
+            size_t len = ctx.rows.len;
+            rill_rows_compact(&ctx.rows);
+            assert(ctx.rows.len == len);
+
+            assert(ctx.rows.len == expected.len);
+            for (size_t i = 0; i < expected.len; ++i)
+                assert(!rill_row_cmp(&expected.data[i], &ctx.rows.data[i]));
+        }
+
+        assert(!rill_query_scan(query, col, 4, scan_abort_fn, NULL));
+        rill_rows_invert(&expected);
+    }
+
+    rill_rows_free(&ctx.rows);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// top
+// -----------------------------------------------------------------------------
+
+bool test_query_top_keys(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        size_t counts[rng_range_a + 1];
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < expected.len; ++i) counts[expected.data[i].a]++;
+
+        size_t max = 0;
+        for (size_t i = 0; i <= rng_range_a; ++i)
+            if (counts[i] > max) max = counts[i];
+
+        enum { k = 10 };
+        size_t len = 0;
+        struct rill_key_count top[k];
+        assert(rill_query_top_keys(query, col, k, top, &len));
+
+        assert(len == k);
+        assert(top[0].count == max);
+        for (size_t i = 0; i < len; ++i) {
+            assert(top[i].count == counts[top[i].key]);
+            assert(!i || top[i - 1].count >= top[i].count);
+        }
+
+        rill_rows_invert(&expected);
+    }
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+bool test_query_set(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_vals result = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        rill_val_t max = col == rill_col_a ? rng_range_a : rng_range_b;
+
+        for (enum rill_set_op op = 0; op <= rill_set_diff; ++op) {
+            for (size_t iterations = 0; iterations < 20; ++iterations) {
+                enum { cap = 4 };
+                rill_val_t keys[cap];
+                size_t len = rng_gen_range(&rng, 1, cap + 1);
+                for (size_t i = 0; i < len; ++i)
+                    keys[i] = rng_gen_range(&rng, 1, max + 10);
+
+                struct rill_vals exp = make_set(&expected, op, keys, len);
+
+                rill_vals_clear(&result);
+                assert(rill_query_set(query, col, op, keys, len, &result));
+
+                assert(result.len == exp.len);
+                for (size_t i = 0; i < exp.len; ++i)
+                    assert(result.data[i] == exp.data[i]);
+
+                rill_vals_free(&exp);
+            }
+        }
+
+        // Key sets too large to live on the stack.
+        enum { small = rng_range_a + 10, large = 1 << 20 };
+        rill_val_t *keys = calloc(large, sizeof(*keys));
+        for (size_t i = 0; i < large; ++i) keys[i] = i % small + 1;
+
+        struct rill_vals exp = make_set(&expected, rill_set_union, keys, small);
+
+        rill_vals_clear(&result);
+        assert(rill_query_set(query, col, rill_set_union, keys, large, &result));
+        assert(result.len == exp.len);
+        for (size_t i = 0; i < exp.len; ++i)
+            assert(result.data[i] == exp.data[i]);
+
+        rill_vals_free(&exp);
+        free(keys);
+
+        rill_rows_invert(&expected);
+    }
+
+    rill_vals_free(&result);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// expand
+// -----------------------------------------------------------------------------
+
+bool test_query_expand(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_rows inverted = {0};
+    rill_rows_copy(&expected, &inverted);
+    rill_rows_invert(&inverted);
+
+    struct rill_vals result = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        rill_val_t max = col == rill_col_a ? rng_range_a : rng_range_b;
+
+        for (rill_val_t key = 0; key <= max + 10; key += 7) {
+            struct rill_vals hop = make_set(&expected, rill_set_union, &key, 1);
+            struct rill_vals exp = hop.len ?
+                make_set(&inverted, rill_set_union, hop.data, hop.len) :
+                (struct rill_vals) {0};
+
+            rill_vals_clear(&result);
+            assert(rill_query_expand(query, col, key, &result));
+
+            assert(result.len == exp.len);
+            for (size_t i = 0; i < exp.len; ++i)
+                assert(result.data[i] == exp.data[i]);
+
+            rill_vals_free(&hop);
+            rill_vals_free(&exp);
+        }
+
+        struct rill_rows tmp = expected;
+        expected = inverted;
+        inverted = tmp;
+    }
+
+    rill_vals_free(&result);
+    rill_rows_free(&inverted);
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// similar
+// -----------------------------------------------------------------------------
+
+bool test_query_similar(void)
+{
+    rm(query_dir);
+    mkdir(query_dir, 0775);
+
+    // Values of each key are spread over two month stores and an hour store
+    // which doesn't have a minhash section.
+    for (size_t i = 0; i < 3; ++i) {
+        struct rill_rows rows = {0};
+
+        for (rill_val_t b = 1; b <= 300; ++b) {
+            if (b % 3 != i) continue;
+            assert(rill_rows_push(&rows, 1, b));
+            if (b <= 270) assert(rill_rows_push(&rows, 2, b));
+            if (b <= 150) assert(rill_rows_push(&rows, 3, b));
+            assert(rill_rows_push(&rows, 4, b + 5000));
+        }
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%010lu.rill", query_dir, i);
+        size_t quant = i < 2 ? month_secs : hour_secs;
+        assert(rill_store_write(file, i * month_secs, quant, &rows));
+
+        rill_rows_free(&rows);
+    }
+
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    enum { k = 4 };
+    size_t len = 0;
+    struct rill_similar similar[k];
+
+    assert(rill_query_similar(query, 1, k, similar, &len));
+    assert(len >= 1 && len <= 2);
+    assert(similar[0].key == 2);
+    assert(similar[0].similarity >= 0.7);
+    if (len == 2) {
+        assert(similar[1].key == 3);
+        assert(similar[1].similarity < similar[0].similarity);
+    }
+
+    assert(rill_query_similar(query, 1, 1, similar, &len));
+    assert(len == 1 && similar[0].key == 2);
+
+    assert(rill_query_similar(query, 1000, k, similar, &len));
+    assert(!len);
+
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+bool test_query_sketch(void)
+{
+    struct rng rng = rng_make(0);
+    struct rill_rows expected = make_db(&rng);
+    struct rill_query *query = rill_query_open(query_dir);
+    assert(query);
+
+    struct rill_sketch sketch = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        for (size_t i = 0; i < expected.len;) {
+            rill_val_t key = expected.data[i].a;
+
+            size_t len = 0;
+            for (; i < expected.len && expected.data[i].a == key; ++i) len++;
+
+            assert(rill_query_sketch(query, col, key, &sketch));
+            double estimate = rill_sketch_estimate(&sketch);
+            assert(estimate >= len * 0.9 - 1 && estimate <= len * 1.1 + 1);
+        }
+
+        assert(rill_query_sketch(query, col, -1UL, &sketch));
+        assert(rill_sketch_estimate(&sketch) == 0);
+
+        rill_rows_invert(&expected);
+    }
+
+    rill_rows_free(&expected);
+    rill_query_close(query);
+    rm(query_dir);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// main
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    (void) argc, (void) argv;
+    bool ret = true;
+
+    ret = ret && test_query_key();
+    ret = ret && test_query_cache();
+    ret = ret && test_query_refresh();
+    ret = ret && test_query_snapshot();
+    ret = ret && test_query_manifest();
+    ret = ret && test_query_open();
+    ret = ret && test_query_resident();
+    ret = ret && test_query_it();
+    ret = ret && test_query_keys();
+    ret = ret && test_query_batch();
+    ret = ret && test_query_count();
+    ret = ret && test_query_range();
+    ret = ret && test_query_contains();
+    ret = ret && test_query_top_keys();
+    ret = ret && test_query_set();
+    ret = ret && test_query_expand();
+    ret = ret && test_query_sketch();
+    ret = ret && test_query_similar();
+    ret = ret && test_query_scan();
+
+    return ret ? 0 : 1;
+}
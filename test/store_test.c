@@ -22,6 +22,20 @@ static struct rill_store *make_store(const char *name, struct rill_rows *rows)
     return store;
 }
 
+static size_t count_key(const struct rill_store *store, enum rill_col col, rill_val_t key)
+{
+    size_t count = 0;
+    assert(rill_store_count(store, col, key, &count));
+    return count;
+}
+
+static bool contains_row(const struct rill_store *store, rill_val_t a, rill_val_t b)
+{
+    bool found = false;
+    assert(rill_store_contains(store, a, b, &found));
+    return found;
+}
+
 
 // -----------------------------------------------------------------------------
 // query
@@ -37,15 +51,76 @@ static void check_query(struct rill_rows rows)
     struct rill_rows result = {0};
 
     for (size_t col = 0; col < rill_cols; ++col) {
+        assert(store->mph[col]);
+        assert(store->filter[col]);
+
         for (size_t i = 0; i < expected.len;) {
             rill_rows_clear(&result);
             assert(rill_store_query(store, col, expected.data[i].a, &result));
+            assert(count_key(store, col, expected.data[i].a) == result.len);
 
             assert(expected.len - i >= result.len);
             for (size_t j = 0; j < result.len; ++j, ++i)
                 assert(!rill_row_cmp(&expected.data[i], &result.data[j]));
         }
 
+        // keys are never bigger then the range used for the rng rows.
+        size_t false_positives = 0;
+        for (rill_val_t key = 1000; key < 11000; ++key) {
+            if (filter_test(store->filter[col], key)) false_positives++;
+
+            rill_rows_clear(&result);
+            assert(rill_store_query(store, col, key, &result));
+            assert(!result.len);
+            assert(!count_key(store, col, key));
+        }
+        assert(false_positives < 500);
+
+        rill_rows_invert(&expected); // setup for next iteration.
+    }
+
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    rill_rows_free(&expected);
+    rill_rows_free(&result);
+}
+
+static void check_query_keys(struct rill_rows rows)
+{
+    struct rill_rows expected = {0};
+    rill_rows_copy(&rows, &expected);
+    rill_rows_compact(&expected);
+
+    struct rill_store *store = make_store("test.store.query_keys", &rows);
+    struct rill_rows result = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        // every other key along with keys that are out of the store's range.
+        size_t len = 0;
+        rill_val_t keys[expected.len + 2];
+        keys[len++] = 0;
+
+        for (size_t i = 0, n = 0; i < expected.len; ++i) {
+            if (i && expected.data[i].a == expected.data[i - 1].a) continue;
+            if (n++ % 2 == 0) keys[len++] = expected.data[i].a;
+        }
+        keys[len++] = -1UL;
+
+        rill_rows_clear(&result);
+        assert(rill_store_query_keys(store, col, keys, len, &result));
+
+        size_t j = 0;
+        for (size_t i = 0; i < expected.len; ++i) {
+            size_t k = 0;
+            while (k < len && keys[k] != expected.data[i].a) k++;
+            if (k == len) continue;
+
+            assert(j < result.len);
+            assert(!rill_row_cmp(&expected.data[i], &result.data[j]));
+            j++;
+        }
+        assert(j == result.len);
+
         rill_rows_invert(&expected); // setup for next iteration.
     }
 
@@ -66,6 +141,345 @@ bool test_query(void)
     for (size_t iterations = 0; iterations < 10; ++iterations)
         check_query(make_rng_rows(&rng));
 
+    check_query_keys(make_rows(row(1, 10)));
+    check_query_keys(make_rows(row(1, 10), row(2, 20), row(3, 30)));
+    check_query_keys(make_rows(row(1, 10), row(1, 20), row(2, 20), row(3, 10)));
+
+    for (size_t iterations = 0; iterations < 10; ++iterations)
+        check_query_keys(make_rng_rows(&rng));
+
+    // Enough keys to span several windows of prefetched lists.
+    struct rill_rows rows = {0};
+    for (size_t i = 0; i < 1 << 16; ++i)
+        assert(rill_rows_push(&rows, i / 4 + 1, (i % 4) * 1000 + (i / 4) % 1000 + 1));
+    check_query_keys(rows);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// contains
+// -----------------------------------------------------------------------------
+
+static void check_contains(struct rill_rows rows)
+{
+    struct rill_rows expected = {0};
+    rill_rows_copy(&rows, &expected);
+    rill_rows_compact(&expected);
+
+    struct rill_store *store = make_store("test.store.contains", &rows);
+
+    for (size_t i = 0; i < expected.len; ++i) {
+        const struct rill_row *row = &expected.data[i];
+        assert(contains_row(store, row->a, row->b));
+        assert(!contains_row(store, row->a, row->b + 1000));
+        assert(!contains_row(store, row->a + 1000, row->b));
+
+        bool next = i + 1 < expected.len &&
+            expected.data[i + 1].a == row->a &&
+            expected.data[i + 1].b == row->b + 1;
+        assert(contains_row(store, row->a, row->b + 1) == next);
+    }
+
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    rill_rows_free(&expected);
+}
+
+bool test_contains(void)
+{
+    check_contains(make_rows(row(1, 10)));
+    check_contains(make_rows(row(1, 10), row(2, 20)));
+    check_contains(make_rows(row(1, 10), row(1, 11), row(2, 11)));
+    check_contains(make_rows(row(1, 10), row(1, 20), row(1, 20), row(1, 30)));
+
+    struct rng rng = rng_make(0);
+    for (size_t iterations = 0; iterations < 10; ++iterations)
+        check_contains(make_rng_rows(&rng));
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// top
+// -----------------------------------------------------------------------------
+
+static int key_count_cmp(const void *l, const void *r)
+{
+    const struct rill_key_count *lhs = l, *rhs = r;
+    if (lhs->count > rhs->count) return -1;
+    if (lhs->count < rhs->count) return +1;
+    if (lhs->key < rhs->key) return -1;
+    if (lhs->key > rhs->key) return +1;
+    return 0;
+}
+
+static void check_top_keys(struct rill_rows rows)
+{
+    struct rill_rows expected = {0};
+    rill_rows_copy(&rows, &expected);
+    rill_rows_compact(&expected);
+
+    struct rill_store *store = make_store("test.store.top", &rows);
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        struct rill_key_count counts[expected.len + 1];
+        size_t keys = 0;
+
+        for (size_t i = 0; i < expected.len; ++i) {
+            if (!keys || counts[keys - 1].key != expected.data[i].a)
+                counts[keys++] = (struct rill_key_count) { .key = expected.data[i].a };
+            counts[keys - 1].count++;
+        }
+        qsort(counts, keys, sizeof(counts[0]), key_count_cmp);
+
+        for (size_t k = 0; k <= keys + 1; k = k ? k * 2 : 1) {
+            struct rill_key_count top[k + 1];
+            size_t len = 0;
+            assert(rill_store_top_keys(store, col, k, top, &len));
+
+            assert(len == (k < keys ? k : keys));
+            for (size_t i = 0; i < len; ++i) {
+                assert(top[i].key == counts[i].key);
+                assert(top[i].count == counts[i].count);
+            }
+        }
+
+        rill_rows_invert(&expected); // setup for next iteration.
+    }
+
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    rill_rows_free(&expected);
+}
+
+bool test_top_keys(void)
+{
+    check_top_keys(make_rows(row(1, 10)));
+    check_top_keys(make_rows(row(1, 10), row(2, 10), row(2, 20)));
+    check_top_keys(make_rows(row(1, 10), row(1, 20), row(2, 20), row(3, 30)));
+
+    struct rng rng = rng_make(0);
+    for (size_t iterations = 0; iterations < 10; ++iterations)
+        check_top_keys(make_rng_rows(&rng));
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+static void check_set(struct rill_rows rows, struct rng *rng)
+{
+    struct rill_rows expected = {0};
+    rill_rows_copy(&rows, &expected);
+    rill_rows_compact(&expected);
+
+    struct rill_store *store = make_store("test.store.set", &rows);
+    struct rill_vals result = {0};
+
+    for (size_t col = 0; col < rill_cols; ++col) {
+        rill_val_t max = col == rill_col_a ? rng_range_a : rng_range_b;
+
+        for (enum rill_set_op op = 0; op <= rill_set_diff; ++op) {
+            for (size_t iterations = 0; iterations < 10; ++iterations) {
+                enum { cap = 4 };
+                rill_val_t keys[cap];
+                size_t len = rng_gen_range(rng, 1, cap + 1);
+                for (size_t i = 0; i < len; ++i)
+                    keys[i] = rng_gen_range(rng, 1, max + 10);
+
+                struct rill_vals exp = make_set(&expected, op, keys, len);
+
+                rill_vals_clear(&result);
+                assert(rill_store_set(store, col, op, keys, len, &result));
+
+                assert(result.len == exp.len);
+                for (size_t i = 0; i < exp.len; ++i)
+                    assert(result.data[i] == exp.data[i]);
+
+                rill_vals_free(&exp);
+            }
+        }
+
+        for (size_t iterations = 0; iterations < 10; ++iterations) {
+            enum { cap = 32 };
+            rill_val_t keys[cap];
+            size_t len = rng_gen_range(rng, 1, cap + 1);
+            for (size_t i = 0; i < len; ++i)
+                keys[i] = rng_gen_range(rng, 1, max + 10);
+
+            struct rill_vals sorted = {0};
+            for (size_t i = 0; i < len; ++i) assert(rill_vals_push(&sorted, keys[i]));
+            rill_vals_compact(&sorted);
+
+            struct rill_vals exp = make_set(&expected, rill_set_union, keys, len);
+
+            rill_vals_clear(&result);
+            assert(rill_store_expand(store, col, sorted.data, sorted.len, &result));
+
+            assert(result.len == exp.len);
+            for (size_t i = 0; i < exp.len; ++i)
+                assert(result.data[i] == exp.data[i]);
+
+            rill_vals_free(&exp);
+            rill_vals_free(&sorted);
+        }
+
+        rill_rows_invert(&expected); // setup for next iteration.
+    }
+
+    rill_vals_free(&result);
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    rill_rows_free(&expected);
+}
+
+bool test_set(void)
+{
+    struct rng rng = rng_make(0);
+
+    check_set(make_rows(row(1, 10)), &rng);
+    check_set(make_rows(row(1, 10), row(2, 10), row(2, 20)), &rng);
+    check_set(make_rows(row(1, 10), row(1, 20), row(2, 20), row(3, 30)), &rng);
+
+    for (size_t iterations = 0; iterations < 10; ++iterations)
+        check_set(make_rng_rows(&rng), &rng);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// sketch
+// -----------------------------------------------------------------------------
+
+static void check_sketch(
+        struct rill_store *store, enum rill_col col, rill_val_t key,
+        const rill_val_t *vals, size_t len)
+{
+    struct rill_sketch expected = {0};
+    for (size_t i = 0; i < len; ++i) hll_add(expected.regs, vals[i]);
+
+    struct rill_sketch sketch = {0};
+    assert(rill_store_sketch(store, col, key, &sketch));
+    assert(!memcmp(&sketch, &expected, sizeof(sketch)));
+
+    double estimate = rill_sketch_estimate(&sketch);
+    assert(estimate >= len * 0.9 && estimate <= len * 1.1);
+}
+
+bool test_sketch(void)
+{
+    enum { heavy = 20000, light = 100 };
+
+    struct rill_rows rows = {0};
+    rill_val_t vals[heavy];
+    for (size_t i = 0; i < heavy; ++i) {
+        vals[i] = i + 1;
+        rill_rows_push(&rows, 1, vals[i]);
+        if (i < light) rill_rows_push(&rows, 2, vals[i]);
+    }
+
+    struct rill_store *store = make_store("test.store.sketch", &rows);
+
+    assert(store->hll[rill_col_a]);
+    assert(store->hll[rill_col_a]->len == 1);
+    assert(store->hll[rill_col_b]->len == 0);
+
+    struct rill_store_stats stats = {0};
+    assert(rill_store_stats(store, &stats));
+    assert(stats.hll_bytes[rill_col_a] == hll_len(store->hll[rill_col_a]));
+
+    check_sketch(store, rill_col_a, 1, vals, heavy);
+    check_sketch(store, rill_col_a, 2, vals, light);
+    check_sketch(store, rill_col_a, 3, vals, 0);
+
+    rill_val_t keys[] = { 1, 2 };
+    check_sketch(store, rill_col_b, 1, keys, 2);
+    check_sketch(store, rill_col_b, light + 1, keys, 1);
+
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// minhash
+// -----------------------------------------------------------------------------
+
+static struct rill_rows make_similar_rows(void)
+{
+    struct rill_rows rows = {0};
+
+    for (rill_val_t b = 1; b <= 100; ++b) {
+        assert(rill_rows_push(&rows, 1, b));
+        if (b <= 90) assert(rill_rows_push(&rows, 2, b));
+        if (b <= 50) assert(rill_rows_push(&rows, 3, b));
+        if (b <= 50) assert(rill_rows_push(&rows, 3, b + 1000));
+        assert(rill_rows_push(&rows, 4, b + 5000));
+    }
+    assert(rill_rows_push(&rows, 5, 1));
+
+    return rows;
+}
+
+bool test_minhash(void)
+{
+    // writing a store modifies its rows.
+    struct rill_rows rows = make_similar_rows();
+    struct rill_rows copy = make_similar_rows();
+
+    unlink("test.store.minhash");
+    assert(rill_store_write("test.store.minhash", 0, month_secs, &copy));
+    rill_rows_free(&copy);
+    struct rill_store *store = rill_store_open("test.store.minhash");
+    assert(store);
+
+    // key 5 is below the minimum degree.
+    assert(store->minhash);
+    assert(store->minhash->len == 4);
+
+    struct rill_store *plain = make_store("test.store.minhash.plain", &rows);
+    assert(!plain->minhash);
+
+    struct rill_minhash sigs[6];
+    for (rill_val_t key = 1; key <= 5; ++key) {
+        struct rill_minhash other = {0};
+        rill_minhash_reset(&sigs[key]);
+        rill_minhash_reset(&other);
+
+        assert(rill_store_minhash(store, key, &sigs[key]));
+        assert(rill_store_minhash(plain, key, &other));
+        assert(!memcmp(&sigs[key], &other, sizeof(other)));
+    }
+
+    double j2 = rill_minhash_jaccard(&sigs[1], &sigs[2]);
+    double j3 = rill_minhash_jaccard(&sigs[1], &sigs[3]);
+    double j4 = rill_minhash_jaccard(&sigs[1], &sigs[4]);
+    assert(j2 >= 0.7 && j3 >= 0.1 && j3 <= 0.6 && j4 <= 0.1);
+
+    struct rill_vals candidates = {0};
+    assert(rill_store_similar(store, 1, &candidates));
+    rill_vals_compact(&candidates);
+    assert(vals_contains(&candidates, 1));
+    assert(vals_contains(&candidates, 2));
+    assert(!vals_contains(&candidates, 4));
+    assert(!vals_contains(&candidates, 5));
+
+    rill_vals_clear(&candidates);
+    assert(rill_store_similar(plain, 1, &candidates));
+    assert(!candidates.len);
+
+    rill_vals_free(&candidates);
+    rill_store_close(plain);
+    rill_store_close(store);
+    rill_rows_free(&rows);
     return true;
 }
 
@@ -84,10 +498,13 @@ static void check_vals(struct rill_rows rows)
     struct rill_store *store = make_store("test.store.vals", &rows);
 
     for (size_t col = 0; col < rill_cols; ++col) {
-        size_t len = rill_store_vals_count(store, col);
+        size_t len = 0;
+        assert(rill_store_vals_count(store, col, &len));
         rill_val_t *vals = calloc(len, sizeof(*vals));
 
-        assert(rill_store_vals(store, col, vals, len) == len);
+        size_t read = 0;
+        assert(rill_store_vals(store, col, vals, len, &read));
+        assert(read == len);
 
         for (size_t i = 0; i < len; ++i)
             assert(vals[i] == exp[col]->data[i]);
@@ -139,6 +556,41 @@ static void check_it(struct rill_rows rows)
 
         rill_store_it_free(it);
 
+        for (size_t iterations = 0; iterations < 10; ++iterations) {
+            rill_val_t from = expected.data[(iterations * expected.len) / 10].a;
+            rill_val_t to = iterations % 2 ? from + 10 : 0;
+
+            size_t i = 0;
+            while (i < expected.len && expected.data[i].a < from) i++;
+
+            it = rill_store_begin_range(store, col, from, to);
+            for (; i < expected.len && (!to || expected.data[i].a < to); ++i) {
+                assert(rill_store_it_next(it, &row));
+                assert(!rill_row_cmp(&expected.data[i], &row));
+            }
+
+            assert(rill_store_it_next(it, &row));
+            assert(rill_row_nil(&row));
+            rill_store_it_free(it);
+        }
+
+        for (size_t cap = 1; cap <= 64; cap *= 4) {
+            struct rill_row batch[cap];
+            it = rill_store_begin(store, col);
+
+            size_t i = 0, len = 0;
+            while (true) {
+                assert(rill_store_it_next_batch(it, batch, cap, &len));
+                if (!len) break;
+
+                for (size_t j = 0; j < len; ++j, ++i)
+                    assert(!rill_row_cmp(&expected.data[i], &batch[j]));
+            }
+            assert(i == expected.len);
+
+            rill_store_it_free(it);
+        }
+
         rill_rows_invert(&expected); // setup for next iteration.
     }
 
@@ -240,6 +692,495 @@ bool test_merge(void)
 }
 
 
+// -----------------------------------------------------------------------------
+// lazy
+// -----------------------------------------------------------------------------
+
+static void check_lazy_query(
+        struct rill_store *store, const struct rill_rows *expected)
+{
+    struct rill_rows result = {0};
+
+    for (size_t i = 0; i < expected->len;) {
+        rill_rows_clear(&result);
+        assert(rill_store_query(store, rill_col_a, expected->data[i].a, &result));
+        assert(result.len);
+
+        for (size_t j = 0; j < result.len; ++j, ++i)
+            assert(!rill_row_cmp(&expected->data[i], &result.data[j]));
+    }
+
+    rill_rows_free(&result);
+}
+
+static void check_lazy(struct rill_rows a, struct rill_rows b)
+{
+    struct rill_rows rows[] = { a, b };
+    struct rill_rows expected[2] = {0};
+    struct rill_store *stores[2] = {0};
+
+    const char *files[] = { "test.store.lazy.a", "test.store.lazy.b" };
+    for (size_t i = 0; i < 2; ++i) {
+        rill_rows_copy(&rows[i], &expected[i]);
+        rill_rows_compact(&expected[i]);
+
+        unlink(files[i]);
+        assert(rill_store_write(files[i], 0, 0, &rows[i]));
+        stores[i] = rill_store_open_flags(files[i], rill_store_lazy);
+        assert(stores[i]);
+        assert(!(stores[i]->lazy.state & store_mapped));
+    }
+
+    // Only one store can be mapped at a time so every query evicts the other.
+    rill_store_map_cap(1);
+
+    for (size_t round = 0; round < 3; ++round) {
+        for (size_t i = 0; i < 2; ++i) {
+            check_lazy_query(stores[i], &expected[i]);
+            assert(stores[i]->lazy.state & store_mapped);
+            assert(!(stores[1 - i]->lazy.state & store_mapped));
+        }
+    }
+
+    // Keys rejected by the filters shouldn't require a mapping.
+    assert(!contains_row(stores[0], 0, 0));
+    assert(!(stores[0]->lazy.state & store_mapped));
+
+    // A pinned store can't be evicted while the iterator is alive.
+    struct rill_store_it *it = rill_store_begin(stores[0], rill_col_a);
+    check_lazy_query(stores[1], &expected[1]);
+    assert(stores[0]->lazy.state & store_mapped);
+
+    struct rill_row row = {0};
+    for (size_t i = 0; i < expected[0].len; ++i) {
+        assert(rill_store_it_next(it, &row));
+        assert(!rill_row_cmp(&expected[0].data[i], &row));
+    }
+    assert(rill_store_it_next(it, &row));
+    assert(rill_row_nil(&row));
+    rill_store_it_free(it);
+
+    rill_store_map_cap(256);
+
+    for (size_t i = 0; i < 2; ++i) {
+        rill_store_close(stores[i]);
+        rill_rows_free(&rows[i]);
+        rill_rows_free(&expected[i]);
+    }
+}
+
+// Stores that keep being used must outlive those that were only mapped once.
+static void check_lazy_lru(void)
+{
+    struct rill_rows rows[3] = {0};
+    struct rill_store *stores[3] = {0};
+
+    const char *files[] = {
+        "test.store.lru.a", "test.store.lru.b", "test.store.lru.c" };
+    for (size_t i = 0; i < 3; ++i) {
+        rows[i] = make_rows(row(i + 1, 10), row(i + 1, 20));
+
+        // Writing scrambles the rows.
+        struct rill_rows copy = {0};
+        rill_rows_copy(&rows[i], &copy);
+
+        unlink(files[i]);
+        assert(rill_store_write(files[i], 0, 0, &copy));
+        stores[i] = rill_store_open_flags(files[i], rill_store_lazy);
+        assert(stores[i]);
+        rill_rows_free(&copy);
+    }
+
+    rill_store_map_cap(2);
+
+    check_lazy_query(stores[0], &rows[0]);
+    check_lazy_query(stores[1], &rows[1]);
+    check_lazy_query(stores[0], &rows[0]);
+    check_lazy_query(stores[2], &rows[2]);
+
+    assert(stores[0]->lazy.state & store_mapped);
+    assert(!(stores[1]->lazy.state & store_mapped));
+    assert(stores[2]->lazy.state & store_mapped);
+
+    rill_store_map_cap(256);
+
+    for (size_t i = 0; i < 3; ++i) {
+        rill_store_close(stores[i]);
+        rill_rows_free(&rows[i]);
+    }
+}
+
+// Evicted stores must still be mappable once their file is gone.
+static void check_lazy_removed(void)
+{
+    struct rill_rows rows[2] = {0};
+    struct rill_store *stores[2] = {0};
+
+    const char *files[] = { "test.store.removed.a", "test.store.removed.b" };
+    for (size_t i = 0; i < 2; ++i) {
+        rows[i] = make_rows(row(i + 1, 10), row(i + 1, 20));
+
+        // Writing scrambles the rows.
+        struct rill_rows copy = {0};
+        rill_rows_copy(&rows[i], &copy);
+
+        unlink(files[i]);
+        assert(rill_store_write(files[i], 0, 0, &copy));
+        stores[i] = rill_store_open_flags(files[i], rill_store_lazy);
+        assert(stores[i]);
+        rill_rows_free(&copy);
+    }
+
+    rill_store_map_cap(1);
+
+    check_lazy_query(stores[0], &rows[0]);
+    check_lazy_query(stores[1], &rows[1]);
+    assert(!(stores[0]->lazy.state & store_mapped));
+
+    assert(!unlink(files[0]));
+    check_lazy_query(stores[0], &rows[0]);
+    assert(stores[0]->lazy.state & store_mapped);
+    assert(count_key(stores[0], rill_col_a, 1) == 2);
+
+    rill_store_map_cap(256);
+
+    for (size_t i = 0; i < 2; ++i) {
+        rill_store_close(stores[i]);
+        rill_rows_free(&rows[i]);
+    }
+    unlink(files[1]);
+}
+
+// Failing to map a store must be reported rather than read as an empty answer.
+static void check_lazy_unmappable(void)
+{
+    const char *file = "test.store.unmappable";
+    struct rill_rows rows = make_rows(row(1, 10), row(1, 20));
+
+    unlink(file);
+    assert(rill_store_write(file, 0, 0, &rows));
+    struct rill_store *store = rill_store_open_flags(file, rill_store_lazy);
+    assert(store);
+
+    size_t vma_len = store->vma_len;
+    store->vma_len = 1UL << 62;
+
+    size_t len = 0;
+    bool found = false;
+    rill_val_t val = 0;
+    struct rill_key_count top[1];
+    struct rill_store_stats stats = {0};
+
+    assert(!rill_store_vals_count(store, rill_col_a, &len));
+    assert(!rill_store_val_at(store, rill_col_a, 0, &val));
+    assert(!rill_store_vals(store, rill_col_a, &val, 1, &len));
+    assert(!rill_store_count(store, rill_col_a, 1, &len));
+    assert(!rill_store_contains(store, 1, 10, &found));
+    assert(!rill_store_top_keys(store, rill_col_a, 1, top, &len));
+    assert(!rill_store_stats(store, &stats));
+
+    store->vma_len = vma_len;
+    assert(count_key(store, rill_col_a, 1) == 2);
+    assert(contains_row(store, 1, 10));
+
+    rill_store_close(store);
+    rill_rows_free(&rows);
+    unlink(file);
+}
+
+bool test_lazy(void)
+{
+    check_lazy(
+            make_rows(row(1, 10), row(1, 20), row(2, 10)),
+            make_rows(row(3, 30), row(4, 40)));
+    check_lazy_lru();
+    check_lazy_removed();
+    check_lazy_unmappable();
+
+    struct rng rng = rng_make(0);
+    for (size_t iterations = 0; iterations < 5; ++iterations)
+        check_lazy(make_rng_rows(&rng), make_rng_rows(&rng));
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// modes
+// -----------------------------------------------------------------------------
+
+static void check_mode_it(struct rill_store *store, struct rill_rows *expected)
+{
+    for (size_t col = 0; col < rill_cols; ++col) {
+        struct rill_store_it *it = rill_store_begin(store, col);
+        assert(it);
+
+        struct rill_row row = {0};
+        for (size_t i = 0; i < expected->len; ++i) {
+            assert(rill_store_it_next(it, &row));
+            assert(!rill_row_cmp(&expected->data[i], &row));
+        }
+
+        assert(rill_store_it_next(it, &row));
+        assert(rill_row_nil(&row));
+        rill_store_it_free(it);
+
+        rill_rows_invert(expected); // setup for next iteration.
+    }
+}
+
+static void check_mode(unsigned mode, struct rill_rows a, struct rill_rows b)
+{
+    struct rill_rows expected[2] = {0};
+    struct rill_rows rows[] = { a, b };
+    struct rill_store *stores[2] = {0};
+
+    const char *files[] = { "test.store.mode.a", "test.store.mode.b" };
+    for (size_t i = 0; i < 2; ++i) {
+        rill_rows_copy(&rows[i], &expected[i]);
+        rill_rows_compact(&expected[i]);
+
+        unlink(files[i]);
+        assert(rill_store_write(files[i], 0, 0, &rows[i]));
+        stores[i] = rill_store_open_flags(files[i], mode);
+        assert(stores[i]);
+
+        check_mode_it(stores[i], &expected[i]);
+
+        struct rill_rows result = {0};
+        rill_val_t key = expected[i].data[expected[i].len / 2].a;
+        assert(rill_store_query(stores[i], rill_col_a, key, &result));
+        assert(result.len && result.data[0].a == key);
+        rill_rows_free(&result);
+    }
+
+    // Iterating a second time has to refault whatever was dropped.
+    check_mode_it(stores[0], &expected[0]);
+
+    const char *file = "test.store.mode.merge";
+    unlink(file);
+    assert(rill_store_merge(file, 0, 0, stores, 2));
+
+    struct rill_store *merged = rill_store_open_flags(file, mode);
+    assert(merged);
+
+    rill_rows_append(&expected[0], &expected[1]);
+    rill_rows_compact(&expected[0]);
+    check_mode_it(merged, &expected[0]);
+
+    rill_store_close(merged);
+    for (size_t i = 0; i < 2; ++i) {
+        rill_store_close(stores[i]);
+        rill_rows_free(&rows[i]);
+        rill_rows_free(&expected[i]);
+    }
+}
+
+static struct rill_rows make_mode_rows(rill_val_t first, size_t len)
+{
+    struct rill_rows rows = {0};
+    for (size_t i = 0; i < len; ++i)
+        assert(rill_rows_push(&rows, first + i / 512, i % 512 + 1));
+    return rows;
+}
+
+bool test_modes(void)
+{
+    const unsigned modes[] = {
+        0, rill_store_random, rill_store_sequential, rill_store_scan_once,
+        rill_store_lazy | rill_store_scan_once,
+    };
+
+    struct rng rng = rng_make(0);
+    for (size_t i = 0; i < array_len(modes); ++i) {
+        check_mode(modes[i], make_rng_rows(&rng), make_rng_rows(&rng));
+
+        // Large enough for the rows to span several drop windows.
+        check_mode(modes[i],
+                make_mode_rows(1, 1 << 20),
+                make_mode_rows(1 + (1 << 10), 1 << 19));
+    }
+
+    unlink("test.store.mode.conflict");
+    struct rill_rows rows = make_rows(row(1, 10));
+    assert(rill_store_write("test.store.mode.conflict", 0, 0, &rows));
+    assert(!rill_store_open_flags(
+                    "test.store.mode.conflict",
+                    rill_store_random | rill_store_scan_once));
+    rill_rows_free(&rows);
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// resident
+// -----------------------------------------------------------------------------
+
+static bool is_resident(const struct rill_store *store, const void *ptr)
+{
+    const uint8_t *it = ptr;
+    return it >= store->resident && it < store->resident + store->resident_len;
+}
+
+static void check_resident(unsigned flags, struct rill_rows a, struct rill_rows b)
+{
+    struct rill_rows rows[] = { a, b };
+    struct rill_rows expected[2] = {0};
+    struct rill_store *stores[2] = {0};
+
+    const char *files[] = { "test.store.resident.a", "test.store.resident.b" };
+    for (size_t i = 0; i < 2; ++i) {
+        rill_rows_copy(&rows[i], &expected[i]);
+        rill_rows_compact(&expected[i]);
+
+        unlink(files[i]);
+        assert(rill_store_write(files[i], 0, 0, &rows[i]));
+        stores[i] = rill_store_open_flags(files[i], flags);
+        assert(stores[i]);
+
+        assert(!rill_store_resident_bytes(stores[i]));
+        assert(rill_store_resident(stores[i]));
+        assert(rill_store_resident(stores[i]));
+
+        size_t bytes = rill_store_lookup_bytes(stores[i]);
+        assert(rill_store_resident_bytes(stores[i]) == bytes);
+
+        struct rill_store_stats stats = {0};
+        assert(rill_store_stats(stores[i], &stats));
+        assert(stats.resident_bytes == bytes);
+    }
+
+    // Forces lazy stores to be remapped on top of their resident copy.
+    rill_store_map_cap(1);
+
+    for (size_t round = 0; round < 2; ++round) {
+        for (size_t i = 0; i < 2; ++i) {
+            check_lazy_query(stores[i], &expected[i]);
+
+            for (size_t col = 0; col < rill_cols; ++col) {
+                assert(is_resident(stores[i], stores[i]->index[col]));
+                if (stores[i]->mph[col])
+                    assert(is_resident(stores[i], stores[i]->mph[col]));
+            }
+
+            const struct rill_row *row = &expected[i].data[0];
+            assert(contains_row(stores[i], row->a, row->b));
+        }
+    }
+
+    rill_store_map_cap(256);
+
+    for (size_t i = 0; i < 2; ++i) {
+        rill_store_close(stores[i]);
+        rill_rows_free(&rows[i]);
+        rill_rows_free(&expected[i]);
+    }
+}
+
+bool test_resident(void)
+{
+    struct rng rng = rng_make(0);
+    for (size_t iterations = 0; iterations < 3; ++iterations) {
+        check_resident(0, make_rng_rows(&rng), make_rng_rows(&rng));
+        check_resident(rill_store_lazy, make_rng_rows(&rng), make_rng_rows(&rng));
+    }
+
+    // Enough keys for the copy to be backed by huge pages.
+    struct rill_rows rows = {0};
+    for (size_t i = 0; i < 1 << 18; ++i)
+        assert(rill_rows_push(&rows, i + 1, i % 7 + 1));
+    check_resident(0, rows, make_rng_rows(&rng));
+
+    return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// pread
+// -----------------------------------------------------------------------------
+
+static void check_pread(struct rill_rows rows)
+{
+    struct rill_rows keys = {0};
+    rill_rows_copy(&rows, &keys);
+    rill_rows_compact(&keys);
+
+    const char *file = "test.store.pread";
+    unlink(file);
+    assert(rill_store_write(file, 0, 0, &rows));
+
+    struct rill_store *eager = rill_store_open(file);
+    struct rill_store *store = rill_store_open_flags(file, rill_store_pread);
+    assert(eager && store);
+    assert(!(store->lazy.state & store_mapped));
+    assert(rill_store_resident_bytes(store));
+
+    rill_val_t *list = calloc(keys.len + 1, sizeof(*list));
+    size_t len = 0;
+    list[len++] = 0; // never present.
+    for (size_t i = 0; i < keys.len; ++i)
+        if (keys.data[i].a != list[len - 1]) list[len++] = keys.data[i].a;
+
+    struct rill_rows expected = {0}, result = {0};
+    for (size_t i = 0; i < len; ++i) {
+        rill_rows_clear(&expected);
+        rill_rows_clear(&result);
+
+        assert(rill_store_query(eager, rill_col_a, list[i], &expected));
+        assert(rill_store_query(store, rill_col_a, list[i], &result));
+        assert(expected.len == result.len);
+        for (size_t j = 0; j < expected.len; ++j)
+            assert(!rill_row_cmp(&expected.data[j], &result.data[j]));
+
+        assert(count_key(eager, rill_col_a, list[i]) ==
+                count_key(store, rill_col_a, list[i]));
+    }
+
+    rill_rows_clear(&expected);
+    rill_rows_clear(&result);
+    assert(rill_store_query_keys(eager, rill_col_a, list, len, &expected));
+    assert(rill_store_query_keys(store, rill_col_a, list, len, &result));
+    assert(expected.len == result.len);
+    for (size_t j = 0; j < expected.len; ++j)
+        assert(!rill_row_cmp(&expected.data[j], &result.data[j]));
+
+    // None of the lookups should have required a mapping.
+    assert(!(store->lazy.state & store_mapped));
+
+    // Everything else falls back to mapping the store.
+    check_mode_it(store, &keys);
+
+    // Read errors are reported rather than read as a key without rows.
+    assert(!truncate(file, store->head->data_off[rill_col_a]));
+    size_t count = 0;
+    assert(!rill_store_count(store, rill_col_a, list[1], &count));
+    assert(!rill_store_query(store, rill_col_a, list[1], &result));
+
+    free(list);
+    rill_rows_free(&keys);
+    rill_rows_free(&expected);
+    rill_rows_free(&result);
+    rill_store_close(store);
+    rill_store_close(eager);
+    rill_rows_free(&rows);
+}
+
+bool test_pread(void)
+{
+    check_pread(make_rows(row(1, 10), row(1, 20), row(2, 10)));
+
+    struct rng rng = rng_make(0);
+    for (size_t iterations = 0; iterations < 5; ++iterations)
+        check_pread(make_rng_rows(&rng));
+
+    // Lists large enough to span several coalesced reads.
+    check_pread(make_mode_rows(1, 1 << 20));
+
+    return true;
+}
+
+
 // -----------------------------------------------------------------------------
 // main
 // -----------------------------------------------------------------------------
@@ -250,9 +1191,18 @@ int main(int argc, char **argv)
     bool ret = true;
 
     ret = ret && test_query();
+    ret = ret && test_contains();
+    ret = ret && test_top_keys();
+    ret = ret && test_set();
+    ret = ret && test_sketch();
+    ret = ret && test_minhash();
     ret = ret && test_vals();
     ret = ret && test_it();
     ret = ret && test_merge();
+    ret = ret && test_lazy();
+    ret = ret && test_modes();
+    ret = ret && test_resident();
+    ret = ret && test_pread();
 
     return ret ? 0 : 1;
 }
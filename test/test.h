@@ -64,6 +64,62 @@ struct rill_rows make_rng_rows(struct rng *rng)
 }
 
 
+// -----------------------------------------------------------------------------
+// set
+// -----------------------------------------------------------------------------
+
+bool vals_contains(const struct rill_vals *vals, rill_val_t val)
+{
+    for (size_t i = 0; i < vals->len; ++i) {
+        if (vals->data[i] == val) return true;
+    }
+    return false;
+}
+
+// Brute force version of the set operations over the a column of rows.
+struct rill_vals make_set(
+        const struct rill_rows *rows,
+        enum rill_set_op op,
+        const rill_val_t *keys, size_t len)
+{
+    struct rill_vals all = {0};
+    struct rill_vals lists[len];
+    memset(lists, 0, sizeof(lists));
+
+    for (size_t i = 0; i < rows->len; ++i) {
+        for (size_t j = 0; j < len; ++j) {
+            if (rows->data[i].a != keys[j]) continue;
+            assert(rill_vals_push(&lists[j], rows->data[i].b));
+            assert(rill_vals_push(&all, rows->data[i].b));
+        }
+    }
+    rill_vals_compact(&all);
+
+    struct rill_vals result = {0};
+    for (size_t i = 0; i < all.len; ++i) {
+        size_t matches = 0;
+        for (size_t j = 0; j < len; ++j)
+            matches += vals_contains(&lists[j], all.data[i]);
+
+        bool keep = false;
+        switch (op) {
+        case rill_set_union: keep = true; break;
+        case rill_set_intersect: keep = matches == len; break;
+        case rill_set_diff:
+            keep = matches == 1 && vals_contains(&lists[0], all.data[i]);
+            break;
+        default: assert(false);
+        }
+
+        if (keep) assert(rill_vals_push(&result, all.data[i]));
+    }
+
+    for (size_t j = 0; j < len; ++j) rill_vals_free(&lists[j]);
+    rill_vals_free(&all);
+    return result;
+}
+
+
 // -----------------------------------------------------------------------------
 // rm
 // -----------------------------------------------------------------------------